@@ -0,0 +1,269 @@
+/* Check the ordered search API of the burst trie against a sorted copy of the
+ * strings. The first half of the strings of a file is inserted, and the burst
+ * trie is walked with a cursor, while the strings of the second half are 
+ * inserted between its steps. The remaining strings are inserted, and the
+ * trie is walked once more. Then up to CHECKED_STRINGS
+ * strings, spread over the file, are searched with lookup(), lower_bound() 
+ * and prefix_count(), along with half of each, and each with its last 
+ * character raised. The program stops at the first disagreement.
+ *
+ * (Usage: ./burst_trie_check [file] [container-size] )
+ */
+
+#include "include/common.h"
+#include "sort_module.h"
+
+/* the parts of the burst trie that main() sets up in naskitis_copybased_burst_sort.c */
+extern __thread ptr_struct *str_ptr;
+extern uint64_t BUCKET_SIZE_LIM;
+void init();
+
+/* short prefixes are counted over much of the burst trie, so only a sample of
+ * the strings is searched 
+ */
+#define CHECKED_STRINGS 50000
+
+/* the number of steps of the cursor between the strings inserted during a walk */
+#define WALK_INTERVAL 3
+
+/* the distinct strings in sorted order, with the number of times each occurs
+ * in the file, and the running total of those counts
+ */
+ptr_struct *distinct;
+uint64_t *occurrences;
+uint64_t *running_total;
+uint64_t num_distinct=0;
+
+/* the strings in the order of the file, the position of each among the 
+ * distinct strings, and the number of copies of each distinct string inserted
+ * so far 
+ */
+ptr_struct *strings;
+uint64_t *position;
+uint64_t *copies;
+uint64_t num_strings=0, num_inserted=0;
+
+/* compare two strings of given lengths, byte by byte, as unsigned values */
+static int compare(uint8_t *a, uint64_t a_len, uint8_t *b, uint64_t b_len)
+{
+  int r = memcmp(a, b, (a_len < b_len) ? a_len : b_len);
+
+  if(r != 0) return r;
+  return (a_len > b_len) - (a_len < b_len);
+}
+
+static int compare_ptr(const void *a, const void *b)
+{
+  const ptr_struct *x = a, *y = b;
+  return compare(x->key, x->len, y->key, y->len);
+}
+
+/* return the position of the first distinct string that does not sort before
+ * a query. With after_prefix set, return the position of the first string 
+ * that sorts after every string that starts with the query instead.
+ */
+static uint64_t reference_lower_bound(uint8_t *word, uint64_t len, int after_prefix)
+{
+  uint64_t lo=0, hi=num_distinct, mid=0, m=0;
+  int r=0;
+
+  while(lo < hi)
+  {
+    mid = lo + ((hi-lo) >> 1);
+
+    if(after_prefix)
+    {
+      m = (distinct[mid].len < len) ? distinct[mid].len : len;
+      r = (memcmp(distinct[mid].key, word, m) > 0) ? 1 : -1;
+    }
+    else
+    {
+      r = compare(distinct[mid].key, distinct[mid].len, word, len);
+    }
+    if(r < 0) lo=mid+1; else hi=mid;
+  }
+  return lo;
+}
+
+/* insert the next string of the file into the burst trie and the reference */
+static void insert_next()
+{
+  insert_with_len((char *) strings[num_inserted].key, strings[num_inserted].len);
+  copies[position[num_inserted++]]++;
+}
+
+/* walk the burst trie with a cursor, and check that it returns each distinct
+ * string inserted so far, with its count, in sorted order. With an interval,
+ * the next string is inserted after that many steps, and the cursor must 
+ * return it if it sorts after the current string. Return the number of 
+ * strings inserted during the walk.
+ */
+static uint64_t check_walk(char *key, uint64_t interval)
+{
+  burst_cursor cursor;
+  uint64_t p=0, steps=0, walk_inserted=0;
+
+  cursor_init(&cursor, key);
+
+  while(cursor_next(&cursor))
+  {
+    while(p < num_distinct && copies[p] == 0) p++;
+
+    if(p == num_distinct || cursor.count != copies[p] || 
+       compare((uint8_t *) cursor.key, cursor.len, distinct[p].key, distinct[p].len) != 0)
+      fatal("cursor_next() disagrees");
+    p++;
+
+    if(interval != 0 && ++steps % interval == 0 && num_inserted < num_strings)
+    {
+      insert_next();
+      walk_inserted++;
+    }
+  }
+
+  while(p < num_distinct && copies[p] == 0) p++;
+  if(p != num_distinct) fatal("cursor_next() stopped early");
+  return walk_inserted;
+}
+
+/* search a query through the burst trie and the reference, and stop if they disagree */
+static void check_query(uint8_t *word, uint32_t len, char *result)
+{
+  uint64_t j = reference_lower_bound(word, len, 0);
+  uint64_t k = reference_lower_bound(word, len, 1);
+  uint64_t expected_count=0, expected_prefix=0;
+  int64_t r=0;
+
+  if(j < num_distinct && compare(distinct[j].key, distinct[j].len, word, len) == 0)
+    expected_count = occurrences[j];
+  expected_prefix = running_total[k] - running_total[j];
+
+  if(lookup((char *) word, len) != expected_count) fatal("lookup() disagrees");
+  if(prefix_count((char *) word, len) != expected_prefix) fatal("prefix_count() disagrees");
+
+  r = lower_bound((char *) word, len, result);
+
+  if(j == num_distinct)
+  {
+    if(r != -1) fatal("lower_bound() disagrees");
+  }
+  else if(r < 0 || compare((uint8_t *) result, r, distinct[j].key, distinct[j].len) != 0)
+    fatal("lower_bound() disagrees");
+}
+
+int main(int argc, char **argv)
+{
+  uint64_t size=0, capacity=1024, i=0, j=0, longest=0, num_queries=0, stride=0, walk_inserted=0;
+  char *buffer, *x, *end, *result;
+  uint8_t *query;
+  uint32_t len=0;
+
+  if(argc < 2)
+  {
+    puts("Usage: ./burst_trie_check [file] [container-size]");
+    exit(1);
+  }
+  BUCKET_SIZE_LIM = (argc > 2) ? atoi(argv[2]) : 128;
+  str_ptr = calloc(BUCKET_SIZE_LIM*64, sizeof(ptr_struct));
+  if(str_ptr == NULL) fatal(MEMORY_EXHAUSTED);
+
+  buffer = load_file(argv[1], &size);
+  end = buffer+size;
+
+  strings = malloc(capacity * sizeof(ptr_struct));
+  if(strings == NULL) fatal(MEMORY_EXHAUSTED);
+
+  /* record each string and its length */
+  for(x=buffer; x < end; x += len+1)
+  {
+    if(num_strings == capacity)
+    {
+      capacity <<= 1;
+      strings = realloc(strings, capacity * sizeof(ptr_struct));
+      if(strings == NULL) fatal(MEMORY_EXHAUSTED);
+    }
+    len = find_separator(x, end) - x;
+    strings[num_strings].key = (uint8_t *) x;
+    strings[num_strings].len = len;
+    if(len > longest) longest = len;
+    num_strings++;
+  }
+
+  /* sort a copy of the strings, and count the copies of each distinct string */
+  distinct = malloc(num_strings * sizeof(ptr_struct));
+  occurrences = malloc(num_strings * sizeof(uint64_t));
+  running_total = malloc((num_strings+1) * sizeof(uint64_t));
+  if(distinct == NULL || occurrences == NULL || running_total == NULL) fatal(MEMORY_EXHAUSTED);
+
+  memcpy(distinct, strings, num_strings * sizeof(ptr_struct));
+  qsort(distinct, num_strings, sizeof(ptr_struct), compare_ptr);
+
+  for(i=0, running_total[0]=0; i<num_strings; i=j)
+  {
+    for(j=i; j<num_strings && compare_ptr(distinct+i, distinct+j) == 0; j++);
+    distinct[num_distinct] = distinct[i];
+    occurrences[num_distinct] = j-i;
+    running_total[num_distinct+1] = running_total[num_distinct] + j-i;
+    num_distinct++;
+  }
+
+  position = malloc(num_strings * sizeof(uint64_t));
+  copies = calloc(num_distinct, sizeof(uint64_t));
+  if(position == NULL || copies == NULL) fatal(MEMORY_EXHAUSTED);
+
+  for(i=0; i<num_strings; i++) 
+    position[i] = reference_lower_bound(strings[i].key, strings[i].len, 0);
+
+  result = malloc(longest+2);
+  query = malloc(longest+2);
+  if(result == NULL || query == NULL) fatal(MEMORY_EXHAUSTED);
+
+  /* insert the strings in the order of the file, half of them before the
+   * first walk, some during it, and the rest before the second walk 
+   */
+  init();
+  while(num_inserted < num_strings/2) insert_next();
+
+  walk_inserted = check_walk(result, WALK_INTERVAL);
+
+  while(num_inserted < num_strings) insert_next();
+  check_walk(result, 0);
+
+  printf("%lu strings, %lu distinct, %lu inserted during a walk: cursor_next() agrees\n",
+         num_strings, num_distinct, walk_inserted);
+
+  stride = num_strings / CHECKED_STRINGS + 1;
+
+  for(i=0; i<num_strings; i+=stride)
+  {
+    len = strings[i].len;
+    memcpy(query, strings[i].key, len);
+
+    check_query(query, len, result);
+    check_query(query, len/2, result);
+
+    /* a string just after this one, which is usually not in the trie. The
+     * newline and null characters can not occur in a string.
+     */
+    if(len != 0 && query[len-1] != 0xff)
+    {
+      if(++query[len-1] == '\n') query[len-1]++;
+      check_query(query, len, result);
+      num_queries++;
+    }
+    num_queries += 2;
+  }
+
+  printf("%lu strings, %lu distinct, %lu queries: lookup(), lower_bound() and prefix_count() agree\n",
+         num_strings, num_distinct, num_queries);
+
+  free(strings);
+  free(position);
+  free(copies);
+  free(distinct);
+  free(occurrences);
+  free(running_total);
+  free(result);
+  free(query);
+  return 0;
+}
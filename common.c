@@ -1,10 +1,22 @@
 #include "include/common.h"
+#include <pthread.h>
+
+/* on x86-64, the AVX2 variants of the string scans are compiled for the AVX2
+ * target whatever the flags of the build, and are chosen at run time on the 
+ * CPUs that support them 
+ */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define AVX2_DISPATCH
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /* the following code deals with the user interface */
-static int total_searched=0;
-static int total_inserted=0;
-static int inserted=0;
-static int found=0;
+static uint64_t total_searched=0;
+static uint64_t total_inserted=0;
+static uint64_t inserted=0;
+static uint64_t found=0;
 
 /* display an error message and exit the program */
 void fatal(char *str) { puts(str); exit(1); }
@@ -34,16 +46,83 @@ int32_t sncmp(const char  *s1, const char  *s2, uint64_t s1_len, uint64_t s2_len
     if ( s1_len == 0 ) return -1;
     if ( s2_len == 0 ) return 1;
   }
-  return ( *s1 - *s2);
+  return ( (unsigned char) *s1 - (unsigned char) *s2);
+}
+
+#if defined(AVX2_DISPATCH)
+/* return 1 if the CPU supports AVX2. The answer is cached, and threads that 
+ * race to cache it store the same value.
+ */
+static int avx2_supported()
+{
+  static int supported=-1;
+
+  if(supported < 0) supported = __builtin_cpu_supports("avx2") ? 1 : 0;
+  return supported;
+}
+
+/* set_terminator(), 32 characters at a time */
+__attribute__((target("avx2")))
+static void set_terminator_avx2(char *buffer, uint64_t length)
+{
+  uint64_t i=0;
+  const __m256i newline = _mm256_set1_epi8('\n');
+
+  for(; i+32<=length; i+=32)
+  {
+    __m256i block = _mm256_loadu_si256((__m256i *)(buffer+i));
+    block = _mm256_andnot_si256(_mm256_cmpeq_epi8(block, newline), block);
+    _mm256_storeu_si256((__m256i *)(buffer+i), block);
+  }
+  for(; i<length; ++i) if( *(buffer+i) == '\n' ) *(buffer+i) = '\0';
 }
 
+/* find_separator(), 32 characters at a time */
+__attribute__((target("avx2")))
+static char *find_separator_avx2(char *x, char *end)
+{
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i null = _mm256_setzero_si256();
+
+  for(; x+32<=end; x+=32)
+  {
+    __m256i block = _mm256_loadu_si256((__m256i *)x);
+    uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(block, newline), 
+                                                         _mm256_cmpeq_epi8(block, null)));
+    if(mask != 0) return x + __builtin_ctz(mask);
+  }
+  for(; x<end && *x != '\n' && *x != '\0'; ++x);
+  return x;
+}
+#endif
+
 /*
  * scan an array of characters and replace '\n' characters
- * with '\0'
+ * with '\0'. The array is scanned 32 characters at a time with AVX2, when
+ * the CPU supports it, or else 16 at a time with SSE2.
  */
-void set_terminator(char *buffer, int length)
+void set_terminator(char *buffer, uint64_t length)
 {
-  register int32_t i=0;
+  register uint64_t i=0;
+
+#if defined(AVX2_DISPATCH)
+  if(avx2_supported()) 
+  {
+    set_terminator_avx2(buffer, length);
+    return;
+  }
+#endif
+
+#if defined(__SSE2__)
+  const __m128i newline = _mm_set1_epi8('\n');
+  for(; i+16<=length; i+=16)
+  {
+    __m128i block = _mm_loadu_si128((__m128i *)(buffer+i));
+    block = _mm_andnot_si128(_mm_cmpeq_epi8(block, newline), block);
+    _mm_storeu_si128((__m128i *)(buffer+i), block);
+  }
+#endif
+
   for(; i<length; ++i)  
   {
     if( *(buffer+i) == '\n' )   
@@ -53,10 +132,55 @@ void set_terminator(char *buffer, int length)
   }
 }
 
-/* string length routine */
+/* return a pointer to the first '\n' or '\0' character between x and end, or 
+ * end if there is none. These are the characters that delimit the strings in
+ * a file. 
+ */
+char *find_separator(char *x, char *end)
+{
+#if defined(AVX2_DISPATCH)
+  if(avx2_supported()) return find_separator_avx2(x, end);
+#endif
+
+#if defined(__SSE2__)
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i null = _mm_setzero_si128();
+  for(; x+16<=end; x+=16)
+  {
+    __m128i block = _mm_loadu_si128((__m128i *)x);
+    uint32_t mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, newline), 
+                                                   _mm_cmpeq_epi8(block, null)));
+    if(mask != 0) return x + __builtin_ctz(mask);
+  }
+#endif
+
+  for(; x<end && *x != '\n' && *x != '\0'; ++x);
+  return x;
+}
+
+/* string length routine. With SSE2, the string is scanned 16 characters at a 
+ * time using aligned loads, which never cross into the next page. 
+ */
 int32_t slen(char *word)
 {
   char *x=word;
+
+#if defined(__SSE2__)
+  const __m128i null = _mm_setzero_si128();
+  uintptr_t offset = (uintptr_t) x & 15;
+  __m128i *block = (__m128i *) (x - offset);
+
+  /* ignore the characters that precede the string in the first block */
+  uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(block), null)) >> offset;
+  if(mask != 0) return __builtin_ctz(mask);
+
+  for(block++; ; block++)
+  {
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128(block), null));
+    if(mask != 0) return ((char *) block + __builtin_ctz(mask)) - word;
+  }
+#endif
+
   for(; *x != '\0'; ++x);
   return x-word;
 }
@@ -66,39 +190,36 @@ void reset_counters()
   total_searched=total_inserted=inserted=found=0;
 }
 
-int32_t get_inserted()
+uint64_t get_inserted()
 {
   return inserted;
 }
 
-int32_t get_found()
+uint64_t get_found()
 {
   return found;
 }
 
-/* access the data structure to insert the strings found in the 
- * filename that is provided as a parameter. The file supplied must
- * be smaller than 2GB in size, otherwise, the code below has to be
- * modified to support large files, i.e., open64(), lseek64().
- * This should not be required, however, since the caller to this
- * function should be designed to handle multiple files, to allow you 
- * to break a large file into smaller pieces.  
+/* account for strings that were inserted outside of perform_insertion() */
+void count_inserted(uint64_t num)
+{
+  inserted+=num;
+  total_inserted+=num;
+}
+
+/* read an entire file into a null-terminated buffer in memory, and return
+ * the buffer along with the size of the file in bytes 
  */
-double perform_insertion(char *to_insert)
-{ 
+char *load_file(char *filename, uint64_t *size)
+{
    int32_t  input_file=0;
-   int32_t  return_value=0;
-   uint32_t input_file_size=0;
-   uint32_t read_in_so_far=0;
-
+   int64_t  return_value=0;
+   uint64_t input_file_size=0;
+   uint64_t read_in_so_far=0;
    char *buffer=0;
-   char *buffer_start=0;
-   
-   timer start, stop;
-   double insert_real_time=0.0;
-   
+
    /* open the file for reading */
-   if( (input_file=(int32_t) open(to_insert, O_RDONLY))<=0) 
+   if( (input_file=(int32_t) open(filename, O_RDONLY))<=0) 
      fatal(BAD_INPUT);  
      
    /* get the size of the file in bytes */
@@ -108,23 +229,86 @@ double perform_insertion(char *to_insert)
    if( (buffer = (char *)calloc(1, input_file_size+1 )) == NULL) 
      fatal(MEMORY_EXHAUSTED);
      
-   /* keep a pointer to the start of the buffer */
-   buffer_start=buffer;
-   
-   /* read the file into memory and close the file pointer */
    lseek(input_file, 0, SEEK_SET);
 
    /* attempt to read the entire file into memory */
    while(read_in_so_far < input_file_size)
    {
-     return_value=read(input_file, buffer, input_file_size);
-     assert(return_value>=0);
+     return_value=read(input_file, buffer+read_in_so_far, input_file_size-read_in_so_far);
+     if(return_value<=0) fatal(BAD_INPUT);
      read_in_so_far+=return_value;
    }
    close(input_file);
+
+   *size=input_file_size;
+   return buffer;
+}
+
+/* map a file into memory for reading, and return a pointer to the mapping 
+ * along with the size of the file in bytes. The file is read sequentially, 
+ * and the kernel is advised to read ahead accordingly. 
+ */
+char *map_file(char *filename, uint64_t *size)
+{
+   int32_t input_file=0;
+   struct stat input_file_stat;
+   char *buffer=0;
+
+   /* open the file for reading */
+   if( (input_file=(int32_t) open(filename, O_RDONLY))<=0) 
+     fatal(BAD_INPUT);  
+
+   /* get the size of the file in bytes */
+   if(fstat(input_file, &input_file_stat) != 0)
+     fatal(BAD_INPUT);
+
+   *size=input_file_stat.st_size;
+
+   /* an empty file can not be mapped */
+   if(*size == 0)
+   {
+     close(input_file);
+     return "";
+   }
+
+   buffer = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, input_file, 0);
+   if(buffer == MAP_FAILED) fatal(BAD_INPUT);
+
+   madvise(buffer, *size, MADV_SEQUENTIAL);
+   close(input_file);
+   return buffer;
+}
+
+/* release a file that was mapped into memory by map_file() */
+void unmap_file(char *buffer, uint64_t size)
+{
+   if(size != 0) munmap(buffer, size);
+}
+
+/* access the data structure to insert the strings found in the 
+ * filename that is provided as a parameter. The file is mapped into
+ * memory rather than copied, and its strings are inserted straight 
+ * from the mapping along with their lengths, so files of any size
+ * can be processed.
+ */
+double perform_insertion(char *to_insert)
+{ 
+   uint64_t input_file_size=0;
+
+   char *buffer=0;
+   char *buffer_start=0;
+   char *buffer_end=0;
+   char *string_end=0;
    
-   /* make sure that all strings are null terminated */
-   set_terminator(buffer, input_file_size);
+   timer start, stop;
+   double insert_real_time=0.0;
+   
+   /* map the file into memory */
+   buffer=map_file(to_insert, &input_file_size);
+     
+   /* keep a pointer to the start of the buffer */
+   buffer_start=buffer;
+   buffer_end=buffer+input_file_size;
    
    /* start the timer for insertion */  
    gettimeofday(&start, NULL);
@@ -132,16 +316,19 @@ double perform_insertion(char *to_insert)
    /* main insertion loop */
    time_loop_insert: 
 
-   /* insert the first null-terminated string in the buffer */
-   if(insert(buffer))
+   /* find the end of the first string in the buffer, which is delimited by a 
+    * newline or a null character, and insert the string along with its length 
+    */
+   string_end=find_separator(buffer, buffer_end);
+
+   if(insert_with_len(buffer, string_end-buffer))
    {
      inserted++;
    } 
    total_inserted++;
 
    /* point to the next string in the buffer */
-   for(; *buffer != '\0'; buffer++);
-   buffer++;
+   buffer=string_end+1;
 
    /* if the buffer pointer has been incremented to beyond the size of the file,
     * then all strings have been processed, and the insertion is complete. 
@@ -159,10 +346,508 @@ double perform_insertion(char *to_insert)
    * (stop.tv_usec - start.tv_usec );
    insert_real_time = insert_real_time/1000.0;
 
-   /* free the temp buffer used to store the file in memory */
-   free(buffer_start);
+   /* release the mapping of the file */
+   unmap_file(buffer_start, input_file_size);
    
    /* return the elapsed insertion time */
    return insert_real_time;
 }
 
+/* search the data structure for the strings found in the filename that is 
+ * provided as a parameter, counting those that were inserted. As with 
+ * perform_insertion(), the file is mapped into memory.
+ */
+double perform_search(char *to_search)
+{ 
+   uint64_t input_file_size=0;
+
+   char *buffer=0;
+   char *buffer_start=0;
+   char *buffer_end=0;
+   char *string_end=0;
+   
+   timer start, stop;
+   double search_real_time=0.0;
+   
+   buffer=map_file(to_search, &input_file_size);
+   buffer_start=buffer;
+   buffer_end=buffer+input_file_size;
+   
+   gettimeofday(&start, NULL);
+
+   while(buffer - buffer_start < input_file_size)
+   {
+     string_end=find_separator(buffer, buffer_end);
+
+     if(lookup(buffer, string_end-buffer) != 0)
+     {
+       found++;
+     } 
+     total_searched++;
+
+     buffer=string_end+1;
+   }
+
+   gettimeofday(&stop, NULL);
+
+   search_real_time = 1000.0 * ( stop.tv_sec - start.tv_sec ) + 0.001  
+   * (stop.tv_usec - start.tv_usec );
+   search_real_time = search_real_time/1000.0;
+
+   unmap_file(buffer_start, input_file_size);
+   return search_real_time;
+}
+
+/* Streaming insertion reads a file in chunks of STREAM_CHUNK_SIZE bytes on a
+ * background thread, into a ring of NUM_STREAM_BUFFERS buffers, while the 
+ * strings of the chunks already read are inserted. Reading thus overlaps with
+ * insertion, and memory used to buffer the file stays bounded. A string that 
+ * spans the end of a chunk is carried over to the start of the next buffer, 
+ * so that each buffer holds complete strings only.
+ */
+#ifndef STREAM_CHUNK_SIZE
+#define STREAM_CHUNK_SIZE (8*1024*1024)
+#endif
+#define NUM_STREAM_BUFFERS 4
+
+typedef struct stream_buffer
+{
+  char *data;
+  uint64_t size;
+  uint64_t capacity;
+  uint32_t full;
+  uint32_t last;
+}
+stream_buffer;
+
+typedef struct stream
+{
+  int32_t input_file;
+  uint64_t file_size;
+  stream_buffer buffer[NUM_STREAM_BUFFERS];
+  pthread_mutex_t lock;
+  pthread_cond_t filled;
+  pthread_cond_t emptied;
+}
+stream;
+
+/* read up to length bytes from a file, and return the number of bytes read */
+static uint64_t read_fully(int32_t input_file, char *data, uint64_t length)
+{
+  uint64_t read_in_so_far=0;
+  int64_t return_value=0;
+
+  while(read_in_so_far < length)
+  {
+    return_value=read(input_file, data+read_in_so_far, length-read_in_so_far);
+    if(return_value < 0) fatal(BAD_INPUT);
+    if(return_value == 0) break;
+    read_in_so_far+=return_value;
+  }
+  return read_in_so_far;
+}
+
+/* the body of the thread that reads a file into the ring of buffers */
+static void *stream_reader(void *arg)
+{
+  stream *s = (stream *) arg;
+  char *carry=NULL;
+  uint64_t carry_size=0, carry_capacity=0;
+  uint32_t k=0;
+
+  while(1)
+  {
+    stream_buffer *b = s->buffer+k;
+    uint64_t size=0, n=0;
+    char *last_separator=NULL;
+
+    /* wait for the buffer to be consumed */
+    pthread_mutex_lock(&s->lock);
+    while(b->full) pthread_cond_wait(&s->emptied, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+
+    /* start the buffer with the string carried over from the previous chunk */
+    if(b->capacity < carry_size + STREAM_CHUNK_SIZE)
+    {
+      b->capacity = carry_size + STREAM_CHUNK_SIZE;
+      b->data = realloc(b->data, b->capacity);
+      if(b->data == NULL) fatal(MEMORY_EXHAUSTED);
+    }
+    memcpy(b->data, carry, carry_size);
+    size = carry_size;
+
+    /* read chunks until the buffer ends with a complete string, or the file ends */
+    while(1)
+    {
+      n = read_fully(s->input_file, b->data+size, b->capacity-size);
+      size += n;
+      s->file_size += n;
+
+      if(n < b->capacity-(size-n))
+      {
+        last_separator=NULL;
+        break;
+      }
+
+      for(last_separator=b->data+size-1; last_separator >= b->data && 
+          *last_separator != '\n' && *last_separator != '\0'; last_separator--);
+
+      if(last_separator >= b->data) break;
+
+      /* the string is longer than the buffer, so grow the buffer */
+      b->capacity <<= 1;
+      b->data = realloc(b->data, b->capacity);
+      if(b->data == NULL) fatal(MEMORY_EXHAUSTED);
+    }
+
+    if(last_separator == NULL)
+    {
+      /* the file has ended, so the buffer holds the remaining strings */
+      b->size = size;
+      b->last = 1;
+    }
+    else
+    {
+      /* carry the partial string that follows the last separator */
+      b->size = last_separator+1 - b->data;
+      carry_size = size - b->size;
+
+      if(carry_capacity < carry_size)
+      {
+        carry_capacity = carry_size;
+        carry = realloc(carry, carry_capacity);
+        if(carry == NULL) fatal(MEMORY_EXHAUSTED);
+      }
+      memcpy(carry, b->data+b->size, carry_size);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    b->full=1;
+    pthread_cond_signal(&s->filled);
+    pthread_mutex_unlock(&s->lock);
+
+    if(b->last) break;
+    k = (k+1) % NUM_STREAM_BUFFERS;
+  }
+
+  free(carry);
+  return NULL;
+}
+
+/* as perform_insertion(), but the file is streamed through a bounded ring of
+ * buffers by a background thread, so that reading overlaps with insertion. 
+ * The elapsed time thus covers both reading and inserting the file.
+ */
+double perform_streaming_insertion(char *to_insert)
+{
+   stream s;
+   pthread_t reader;
+   uint32_t k=0, last=0;
+   char *buffer, *buffer_end, *string_end;
+
+   timer start, stop;
+   double insert_real_time=0.0;
+
+   memset(&s, 0, sizeof(stream));
+   pthread_mutex_init(&s.lock, NULL);
+   pthread_cond_init(&s.filled, NULL);
+   pthread_cond_init(&s.emptied, NULL);
+
+   /* open the file for reading */
+   if( (s.input_file=(int32_t) open(to_insert, O_RDONLY))<=0) 
+     fatal(BAD_INPUT);  
+
+   posix_fadvise(s.input_file, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+   /* start the timer for insertion */  
+   gettimeofday(&start, NULL);
+
+   if(pthread_create(&reader, NULL, stream_reader, &s) != 0) 
+     fatal(MEMORY_EXHAUSTED);
+
+   while(!last)
+   {
+     stream_buffer *b = s.buffer+k;
+
+     /* wait for the reader to fill the buffer */
+     pthread_mutex_lock(&s.lock);
+     while(!b->full) pthread_cond_wait(&s.filled, &s.lock);
+     pthread_mutex_unlock(&s.lock);
+
+     buffer=b->data;
+     buffer_end=b->data+b->size;
+     last=b->last;
+
+     /* insert each string in the buffer, along with its length */
+     while(buffer < buffer_end)
+     {
+       string_end=find_separator(buffer, buffer_end);
+
+       if(insert_with_len(buffer, string_end-buffer))
+       {
+         inserted++;
+       }
+       total_inserted++;
+
+       buffer=string_end+1;
+     }
+
+     pthread_mutex_lock(&s.lock);
+     b->full=0;
+     pthread_cond_signal(&s.emptied);
+     pthread_mutex_unlock(&s.lock);
+
+     k = (k+1) % NUM_STREAM_BUFFERS;
+   }
+
+   pthread_join(reader, NULL);
+   close(s.input_file);
+
+   /* as in perform_insertion(), an empty file holds a single empty string */
+   if(s.file_size == 0)
+   {
+     if(insert_with_len("", 0))
+     {
+       inserted++;
+     }
+     total_inserted++;
+   }
+
+   /* stop the insertion timer */
+   gettimeofday(&stop, NULL);
+
+   /* do the math to compute the time required for insertion */   
+   insert_real_time = 1000.0 * ( stop.tv_sec - start.tv_sec ) + 0.001  
+   * (stop.tv_usec - start.tv_usec );
+   insert_real_time = insert_real_time/1000.0;
+
+   for(k=0; k<NUM_STREAM_BUFFERS; k++) free(s.buffer[k].data);
+   pthread_mutex_destroy(&s.lock);
+   pthread_cond_destroy(&s.filled);
+   pthread_cond_destroy(&s.emptied);
+
+   return insert_real_time;
+}
+
+/* The output stage collects sorted strings into a large, page-aligned buffer
+ * and hands full buffers to the kernel with write()/writev(), rather than 
+ * printing each string through stdio. Strings are appended as a prefix and a
+ * suffix, so the full string need not be built first. A run of duplicates is
+ * written once and then repeated by copying the bytes already in the buffer.
+ */
+#ifndef OUTPUT_BUFFER_SIZE
+#define OUTPUT_BUFFER_SIZE (4*1024*1024)
+#endif
+#define OUTPUT_IOV_MAX 1024
+
+static char *output_buffer=NULL;
+static uint64_t output_size=0;
+static int32_t output_file=-1;
+static uint64_t output_bytes=0;
+
+/* write out a vector of blocks in full, continuing after partial writes */
+static void write_vector(struct iovec *iov, int32_t count)
+{
+  int64_t written=0;
+
+  while(count > 0)
+  {
+    if( (written=writev(output_file, iov, count)) < 0) fatal(BAD_OUTPUT);
+    output_bytes+=written;
+
+    while(count > 0 && (uint64_t) written >= iov->iov_len)
+    {
+      written-=iov->iov_len;
+      iov++;
+      count--;
+    }
+    if(count > 0)
+    {
+      iov->iov_base=(char *) iov->iov_base + written;
+      iov->iov_len-=written;
+    }
+  }
+}
+
+/* prepare to write output to a file descriptor */
+void output_init(int32_t file)
+{
+  output_file=file;
+  output_size=0;
+  output_bytes=0;
+  if(output_buffer == NULL && posix_memalign((void **) &output_buffer, 4096, OUTPUT_BUFFER_SIZE) != 0) 
+    fatal(MEMORY_EXHAUSTED);
+}
+
+/* write out the contents of the output buffer */
+void output_flush()
+{
+  struct iovec iov;
+
+  if(output_size == 0) return;
+
+  iov.iov_base=output_buffer;
+  iov.iov_len=output_size;
+  write_vector(&iov, 1);
+  output_size=0;
+}
+
+/* append a block of bytes to the output, writing large blocks directly */
+void output_block(char *data, uint64_t length)
+{
+  struct iovec iov[2];
+
+  if(output_size + length <= OUTPUT_BUFFER_SIZE)
+  {
+    memcpy(output_buffer+output_size, data, length);
+    output_size+=length;
+    return;
+  }
+
+  iov[0].iov_base=output_buffer;
+  iov[0].iov_len=output_size;
+  iov[1].iov_base=data;
+  iov[1].iov_len=length;
+  write_vector(iov, 2);
+  output_size=0;
+}
+
+/* append a string, made of a prefix and a suffix, followed by a newline */
+void output_string(char *prefix, uint32_t prefix_len, char *suffix, uint32_t suffix_len)
+{
+  uint64_t length = (uint64_t) prefix_len + suffix_len + 1;
+
+  if(output_size + length > OUTPUT_BUFFER_SIZE)
+  {
+    output_flush();
+
+    if(length > OUTPUT_BUFFER_SIZE)
+    {
+      output_block(prefix, prefix_len);
+      output_block(suffix, suffix_len);
+      output_block("\n", 1);
+      return;
+    }
+  }
+
+  memcpy(output_buffer+output_size, prefix, prefix_len);
+  memcpy(output_buffer+output_size+prefix_len, suffix, suffix_len);
+  output_size+=length;
+  *(output_buffer+output_size-1)='\n';
+}
+
+/* append a string, followed by a newline, num times. The string is written
+ * once; the copies already in the buffer are then doubled until the buffer is
+ * full, after which the run of copies is written repeatedly with writev(). If
+ * the copies do not fit in the room left, the buffer is written out first, so
+ * that the run can fill all of it. 
+ */
+void output_repeat(char *str, uint32_t len, uint64_t num)
+{
+  struct iovec iov[OUTPUT_IOV_MAX];
+  uint64_t length = (uint64_t) len + 1;
+  uint64_t run_start=0, copies=1, more=0;
+  int32_t count=0;
+
+  if(num == 0) return;
+
+  if(length > OUTPUT_BUFFER_SIZE/2)
+  {
+    for(; num > 0; num--) output_string(str, len, NULL, 0);
+    return;
+  }
+
+  if(num*length > OUTPUT_BUFFER_SIZE-output_size) output_flush();
+
+  output_string(str, len, NULL, 0);
+  run_start=output_size-length;
+  num--;
+
+  /* double the run of copies within the buffer */
+  while(num > 0)
+  {
+    more = (OUTPUT_BUFFER_SIZE-output_size) / length;
+    if(more > copies) more = copies;
+    if(more > num) more = num;
+    if(more == 0) break;
+
+    memcpy(output_buffer+output_size, output_buffer+run_start, more*length);
+    output_size+=more*length;
+    copies+=more;
+    num-=more;
+  }
+
+  if(num == 0) return;
+
+  /* the buffer is full; write it, then the run as many times as needed */
+  iov[0].iov_base=output_buffer;
+  iov[0].iov_len=output_size;
+  count=1;
+
+  while(num >= copies)
+  {
+    iov[count].iov_base=output_buffer+run_start;
+    iov[count].iov_len=copies*length;
+    count++;
+    num-=copies;
+
+    if(count == OUTPUT_IOV_MAX)
+    {
+      write_vector(iov, count);
+      count=0;
+    }
+  }
+  if(count > 0) write_vector(iov, count);
+
+  /* keep the remaining copies at the start of the buffer */
+  memmove(output_buffer, output_buffer+run_start, num*length);
+  output_size=num*length;
+}
+
+/* write out whatever remains in the buffer, and return the number of bytes
+ * written since output_init()
+ */
+uint64_t output_finish()
+{
+  output_flush();
+  return output_bytes;
+}
+
+/* return the size, in bytes, of the data or unified cache at the given level of
+ * the cache hierarchy of the first CPU, as reported by sysfs, or 0 if it is
+ * not known 
+ */
+uint64_t cache_size(uint32_t level)
+{
+  char name[256], type[64];
+  uint32_t index=0, cache_level=0;
+  uint64_t size=0;
+  char unit=0;
+  FILE *f;
+
+  for(index=0; ; index++)
+  {
+    snprintf(name, sizeof(name), "/sys/devices/system/cpu/cpu0/cache/index%u/level", index);
+    if( (f=fopen(name, "r")) == NULL) return 0;
+    if(fscanf(f, "%u", &cache_level) != 1) cache_level=0;
+    fclose(f);
+
+    if(cache_level != level) continue;
+
+    snprintf(name, sizeof(name), "/sys/devices/system/cpu/cpu0/cache/index%u/type", index);
+    if( (f=fopen(name, "r")) == NULL) continue;
+    if(fscanf(f, "%63s", type) != 1) type[0]='\0';
+    fclose(f);
+
+    if(strcmp(type, "Data") != 0 && strcmp(type, "Unified") != 0) continue;
+
+    snprintf(name, sizeof(name), "/sys/devices/system/cpu/cpu0/cache/index%u/size", index);
+    if( (f=fopen(name, "r")) == NULL) continue;
+    if(fscanf(f, "%lu%c", &size, &unit) < 1) size=0;
+    fclose(f);
+
+    if(unit == 'K') size <<= 10;
+    if(unit == 'M') size <<= 20;
+    return size;
+  }
+}
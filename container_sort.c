@@ -0,0 +1,371 @@
+/* A source-level sort for the strings of a container. The strings are sorted 
+ * a character at a time, so that the characters of a prefix that is known to
+ * be shared are never compared again. Small sets of strings are sorted by 
+ * insertion sort, large sets are first split on their leading character with 
+ * an in-place MSD radix sort (American flag sort), and the rest are sorted 
+ * with a multikey quicksort. Strings are compared as unsigned bytes, and a 
+ * string sorts before any string that it prefixes.
+ */
+
+#include "include/common.h"
+#include "sort_module.h"
+
+#define INSERTION_SORT_THRESHOLD 16
+#define RADIX_SORT_THRESHOLD 256
+
+/* return the character of a string at the given depth, or -1 if the string 
+ * has been consumed 
+ */
+static inline int32_t char_at(const ptr_struct *p, uint64_t depth)
+{
+  return (depth < p->len) ? (int32_t) *(p->key + depth) : -1;
+}
+
+static inline void swap(ptr_struct *data, uint64_t a, uint64_t b)
+{
+  ptr_struct tmp = data[a];
+  data[a] = data[b];
+  data[b] = tmp;
+}
+
+/* compare two strings that are known to share their first depth characters */
+static inline int32_t compare_from(const ptr_struct *a, const ptr_struct *b, uint64_t depth)
+{
+  uint64_t len = (a->len < b->len) ? a->len : b->len;
+  const uint8_t *x = a->key + depth, *y = b->key + depth;
+
+  for(; depth < len; depth++, x++, y++)
+  {
+    if(*x != *y) return (int32_t) *x - (int32_t) *y;
+  }
+
+  if(a->len == b->len) return 0;
+  return (a->len < b->len) ? -1 : 1;
+}
+
+/* sort a small set of strings that share their first depth characters */
+static void insertion_sort(ptr_struct *data, uint64_t n, uint64_t depth)
+{
+  uint64_t i=0, j=0;
+
+  for(i=1; i<n; i++)
+  {
+    ptr_struct tmp = data[i];
+
+    for(j=i; j>0 && compare_from(data+j-1, &tmp, depth) > 0; j--)
+    {
+      data[j] = data[j-1];
+    }
+    data[j] = tmp;
+  }
+}
+
+/* return the median of three characters */
+static inline int32_t median_of_three(int32_t a, int32_t b, int32_t c)
+{
+  if(a < b)
+  {
+    if(b < c) return b;
+    return (a < c) ? c : a;
+  }
+  if(a < c) return a;
+  return (b < c) ? c : b;
+}
+
+static void multikey_qsort(ptr_struct *data, uint64_t n, uint64_t depth);
+
+/* split a large set of strings on their character at the given depth, using
+ * an in-place MSD radix sort, and then sort each bucket. Only the buckets 
+ * smaller than the largest are sorted by recursion, each with at most half of
+ * the strings, and the largest is split in turn on its next character. The 
+ * stack thus holds no more than a logarithmic number of these frames, however 
+ * long the prefix that the strings share.
+ */
+static void radix_sort(ptr_struct *data, uint64_t n, uint64_t depth)
+{
+  uint64_t count[257], next[257], end[257];
+  uint64_t i=0, b=0, largest=0, largest_start=0;
+
+  while(n >= RADIX_SORT_THRESHOLD)
+  {
+    memset(count, 0, sizeof(count));
+    for(i=0; i<n; i++) count[char_at(data+i, depth)+1]++;
+
+    /* strings that share this character are left in place for the next one,
+     * unless they are consumed, and thus equal 
+     */
+    b = char_at(data, depth)+1;
+    if(count[b] == n)
+    {
+      if(b == 0) return;
+      depth++;
+      continue;
+    }
+
+    for(b=0, i=0; b<257; b++)
+    {
+      next[b] = i;
+      i += count[b];
+      end[b] = i;
+    }
+
+    /* move each string into its bucket by following cycles of displaced strings */
+    for(b=0; b<257; b++)
+    {
+      while(next[b] < end[b])
+      {
+        ptr_struct tmp = data[next[b]];
+        uint32_t c = char_at(&tmp, depth)+1;
+
+        while(c != b)
+        {
+          ptr_struct displaced = data[next[c]];
+          data[next[c]++] = tmp;
+          tmp = displaced;
+          c = char_at(&tmp, depth)+1;
+        }
+        data[next[b]++] = tmp;
+      }
+    }
+
+    for(b=2, largest=1; b<257; b++)
+    {
+      if(count[b] > count[largest]) largest = b;
+    }
+
+    /* the strings in the first bucket are consumed, and are thus equal */
+    for(b=1, i=count[0]; b<257; i+=count[b], b++)
+    {
+      if(b == largest)       largest_start = i;
+      else if(count[b] > 1)  multikey_qsort(data+i, count[b], depth+1);
+    }
+
+    data += largest_start;
+    n = count[largest];
+    depth++;
+  }
+
+  if(n > 1) multikey_qsort(data, n, depth);
+}
+
+/* sort a set of strings that share their first depth characters, with a 
+ * multikey (three-way radix) quicksort 
+ */
+static void multikey_qsort(ptr_struct *data, uint64_t n, uint64_t depth)
+{
+  while(n > INSERTION_SORT_THRESHOLD)
+  {
+    if(n >= RADIX_SORT_THRESHOLD) 
+    {
+      radix_sort(data, n, depth);
+      return;
+    }
+
+    int32_t pivot = median_of_three(char_at(data, depth), 
+                                    char_at(data + (n>>1), depth), 
+                                    char_at(data + n-1, depth));
+    uint64_t lt=0, gt=n, i=0;
+
+    /* partition the strings into those less than, equal to and greater than the pivot */
+    while(i < gt)
+    {
+      int32_t c = char_at(data+i, depth);
+
+      if(c < pivot)       swap(data, lt++, i++);
+      else if(c > pivot)  swap(data, i, --gt);
+      else                i++;
+    }
+
+    if(lt > 1)     multikey_qsort(data, lt, depth);
+    if(n-gt > 1)   multikey_qsort(data+gt, n-gt, depth);
+
+    /* the strings equal to a consumed pivot are identical */
+    if(pivot == -1) return;
+
+    data += lt;
+    n = gt-lt;
+    depth++;
+  }
+
+  insertion_sort(data, n, depth);
+}
+
+/* sort the strings of a container */
+void container_sort(ptr_struct *data, const uint64_t n)
+{
+  if(n > 1) multikey_qsort(data, n, 0);
+}
+
+/* With a cached prefix, each string is sorted through a record that also holds
+ * eight of its characters, loaded as a big-endian integer. Most comparisons are
+ * thus made between integers held in the records, rather than by following the
+ * pointers into the container. When the cached characters of a set of strings
+ * are equal, the next eight characters are loaded. 
+ */
+typedef struct cached_ptr_struct
+{
+  uint64_t prefix;
+  uint8_t *key;
+  uint64_t len;
+}
+cached_ptr_struct;
+
+static __thread cached_ptr_struct *cached=NULL;
+static __thread uint64_t cached_capacity=0;
+
+/* load eight characters of a string from the given depth, padded with zeros */
+static inline uint64_t load_prefix(const uint8_t *key, uint64_t len, uint64_t depth)
+{
+  uint64_t prefix=0;
+  uint32_t i=0;
+
+  if(depth+8 <= len)
+  {
+    memcpy(&prefix, key+depth, 8);
+    return __builtin_bswap64(prefix);
+  }
+
+  for(i=0; i<8; i++)
+  {
+    prefix = (prefix << 8) | ( (depth+i < len) ? *(key+depth+i) : 0 );
+  }
+  return prefix;
+}
+
+static inline void swap_cached(cached_ptr_struct *data, uint64_t a, uint64_t b)
+{
+  cached_ptr_struct tmp = data[a];
+  data[a] = data[b];
+  data[b] = tmp;
+}
+
+/* compare two records with cached prefixes loaded from the same depth */
+static inline int32_t compare_cached(const cached_ptr_struct *a, const cached_ptr_struct *b, uint64_t depth)
+{
+  if(a->prefix != b->prefix) return (a->prefix < b->prefix) ? -1 : 1;
+
+  ptr_struct x = { a->key, a->len }, y = { b->key, b->len };
+  if(a->len <= depth+8 || b->len <= depth+8)
+  {
+    if(a->len == b->len) return 0;
+    return (a->len < b->len) ? -1 : 1;
+  }
+  return compare_from(&x, &y, depth+8);
+}
+
+static inline uint64_t median_of_three_prefixes(uint64_t a, uint64_t b, uint64_t c)
+{
+  if(a < b)
+  {
+    if(b < c) return b;
+    return (a < c) ? c : a;
+  }
+  if(a < c) return a;
+  return (b < c) ? c : b;
+}
+
+/* sort a set of records that share their first depth characters, with a 
+ * three-way quicksort on their cached prefixes 
+ */
+static void cached_qsort(cached_ptr_struct *data, uint64_t n, uint64_t depth)
+{
+  uint64_t i=0, j=0;
+
+  while(n > INSERTION_SORT_THRESHOLD)
+  {
+    uint64_t pivot = median_of_three_prefixes(data[0].prefix, data[n>>1].prefix, data[n-1].prefix);
+    uint64_t lt=0, gt=n;
+
+    i=0;
+    while(i < gt)
+    {
+      if(data[i].prefix < pivot)       swap_cached(data, lt++, i++);
+      else if(data[i].prefix > pivot)  swap_cached(data, i, --gt);
+      else                             i++;
+    }
+
+    if(lt > 1)     cached_qsort(data, lt, depth);
+    if(n-gt > 1)   cached_qsort(data+gt, n-gt, depth);
+
+    /* the records equal to the pivot share depth+8 characters. Those that end 
+     * within these characters come first, by length, and the rest continue with 
+     * their next eight characters.
+     */
+    data += lt;
+    n = gt-lt;
+
+    for(i=0, j=0; i<n; i++)
+    {
+      if(data[i].len <= depth+8) swap_cached(data, i, j++);
+    }
+    if(j > 1)
+    {
+      for(i=1; i<j; i++)
+      {
+        cached_ptr_struct tmp = data[i];
+        uint64_t k=i;
+        for(; k>0 && data[k-1].len > tmp.len; k--) data[k] = data[k-1];
+        data[k] = tmp;
+      }
+    }
+
+    data += j;
+    n -= j;
+    depth += 8;
+
+    for(i=0; i<n; i++)
+    {
+      data[i].prefix = load_prefix(data[i].key, data[i].len, depth);
+    }
+  }
+
+  for(i=1; i<n; i++)
+  {
+    cached_ptr_struct tmp = data[i];
+
+    for(j=i; j>0 && compare_cached(data+j-1, &tmp, depth) > 0; j--)
+    {
+      data[j] = data[j-1];
+    }
+    data[j] = tmp;
+  }
+}
+
+/* sort the strings of a container through records with cached prefixes. Sets
+ * large enough for the radix sort are left to container_sort(), which does not
+ * compare strings. 
+ */
+void container_sort_cached(ptr_struct *data, const uint64_t n)
+{
+  uint64_t i=0;
+
+  if(n < 2) return;
+
+  if(n >= RADIX_SORT_THRESHOLD)
+  {
+    multikey_qsort(data, n, 0);
+    return;
+  }
+
+  if(n > cached_capacity)
+  {
+    cached_capacity = (n > 2*cached_capacity) ? n : 2*cached_capacity;
+    cached = realloc(cached, cached_capacity * sizeof(cached_ptr_struct));
+    if(cached == NULL) fatal(MEMORY_EXHAUSTED);
+  }
+
+  for(i=0; i<n; i++)
+  {
+    cached[i].prefix = load_prefix(data[i].key, data[i].len, 0);
+    cached[i].key = data[i].key;
+    cached[i].len = data[i].len;
+  }
+
+  cached_qsort(cached, n, 0);
+
+  for(i=0; i<n; i++)
+  {
+    data[i].key = cached[i].key;
+    data[i].len = cached[i].len;
+  }
+}
@@ -0,0 +1,176 @@
+/* Compare the time taken by tuned_qsort(), container_sort() and 
+ * container_sort_cached() to sort sets of 
+ * strings the size of a container, at container limits between 64 and 512. 
+ * The strings are read from a file, and consecutive strings are grouped into 
+ * containers. Each sort is checked against the other, on the file and on a 
+ * set of strings that share a long prefix.
+ *
+ * (Usage: ./container_sort_benchmark [file] [repetitions] )
+ */
+
+#include "include/common.h"
+#include "sort_module.h"
+
+/* perform_insertion() and perform_search() in common.c require a data structure,
+ * but are not used here 
+ */
+int insert(char *word) { return 0; }
+int insert_with_len(char *word, uint32_t len) { return 0; }
+uint64_t lookup(char *word, uint32_t len) { return 0; }
+
+/* a set of strings that share a long prefix. A radix sort per shared character
+ * once overflowed the stack of container_sort() on such a set.
+ */
+#define SHARED_PREFIX_LEN 20000
+#define SHARED_PREFIX_STRINGS 512
+
+/* the time elapsed between two timers, in seconds */
+double elapsed(timer *start, timer *stop)
+{
+  return ( stop->tv_sec - start->tv_sec ) + 0.000001 * ( stop->tv_usec - start->tv_usec );
+}
+
+/* sort every container with the given sort, and return the time required */
+double time_sort(void (*sort)(ptr_struct *, const uint64_t), ptr_struct *data, 
+                 ptr_struct *original, uint64_t num_strings, uint64_t limit, int repetitions)
+{
+  timer start, stop;
+  double total=0.0;
+  uint64_t i=0;
+  int r=0;
+
+  for(r=0; r<repetitions; r++)
+  {
+    memcpy(data, original, num_strings * sizeof(ptr_struct));
+
+    gettimeofday(&start, NULL);
+    for(i=0; i<num_strings; i+=limit)
+    {
+      sort(data+i, (num_strings-i < limit) ? num_strings-i : limit);
+    }
+    gettimeofday(&stop, NULL);
+
+    total += elapsed(&start, &stop);
+  }
+  return total;
+}
+
+/* stop if the sorts of container_sort() or container_sort_cached() disagree 
+ * with those of tuned_qsort() 
+ */
+void check_sorts(ptr_struct *by_qsort, ptr_struct *by_container_sort, 
+                 ptr_struct *by_cached_sort, uint64_t num_strings)
+{
+  uint64_t i=0;
+
+  for(i=0; i<num_strings; i++)
+  {
+    if(sncmp((char *) by_qsort[i].key, (char *) by_container_sort[i].key, 
+             by_qsort[i].len, by_container_sort[i].len) != 0 ||
+       sncmp((char *) by_qsort[i].key, (char *) by_cached_sort[i].key, 
+             by_qsort[i].len, by_cached_sort[i].len) != 0)
+      fatal("The sorts disagree");
+  }
+}
+
+/* sort a set of strings that share a long prefix with each sort. The strings
+ * end with up to three characters of their own, or with none. 
+ */
+void check_shared_prefix()
+{
+  uint8_t *keys = malloc(SHARED_PREFIX_STRINGS * (SHARED_PREFIX_LEN+3));
+  ptr_struct *sets = malloc(3 * SHARED_PREFIX_STRINGS * sizeof(ptr_struct));
+  uint64_t i=0, j=0;
+
+  if(keys == NULL || sets == NULL) fatal(MEMORY_EXHAUSTED);
+
+  for(i=0; i<SHARED_PREFIX_STRINGS; i++)
+  {
+    uint8_t *key = keys + i * (SHARED_PREFIX_LEN+3);
+
+    memset(key, 'q', SHARED_PREFIX_LEN);
+    sets[i].key = key;
+    sets[i].len = SHARED_PREFIX_LEN + i%4;
+    for(j=SHARED_PREFIX_LEN; j<sets[i].len; j++) key[j] = 'a' + (i*7919 >> j%8) % 8;
+  }
+  memcpy(sets+SHARED_PREFIX_STRINGS, sets, SHARED_PREFIX_STRINGS * sizeof(ptr_struct));
+  memcpy(sets+2*SHARED_PREFIX_STRINGS, sets, SHARED_PREFIX_STRINGS * sizeof(ptr_struct));
+
+  tuned_qsort(sets, SHARED_PREFIX_STRINGS);
+  container_sort(sets+SHARED_PREFIX_STRINGS, SHARED_PREFIX_STRINGS);
+  container_sort_cached(sets+2*SHARED_PREFIX_STRINGS, SHARED_PREFIX_STRINGS);
+  check_sorts(sets, sets+SHARED_PREFIX_STRINGS, sets+2*SHARED_PREFIX_STRINGS, SHARED_PREFIX_STRINGS);
+
+  printf("%d strings sharing a %d-character prefix: the sorts agree\n", 
+         SHARED_PREFIX_STRINGS, SHARED_PREFIX_LEN);
+  free(keys);
+  free(sets);
+}
+
+int main(int argc, char **argv)
+{
+  uint64_t size=0, num_strings=0, capacity=1024, i=0, limit=0;
+  int repetitions=3;
+  char *buffer, *x;
+  ptr_struct *original, *by_qsort, *by_container_sort, *by_cached_sort;
+
+  if(argc < 2) 
+  {
+    puts("Usage: ./container_sort_benchmark [file] [repetitions]");
+    exit(1);
+  }
+  if(argc > 2) repetitions = atoi(argv[2]);
+
+  buffer = load_file(argv[1], &size);
+  set_terminator(buffer, size);
+
+  original = malloc(capacity * sizeof(ptr_struct));
+  if(original == NULL) fatal(MEMORY_EXHAUSTED);
+
+  /* record each string and its length */
+  for(x=buffer; x < buffer+size; x++)
+  {
+    if(num_strings == capacity)
+    {
+      capacity <<= 1;
+      original = realloc(original, capacity * sizeof(ptr_struct));
+      if(original == NULL) fatal(MEMORY_EXHAUSTED);
+    }
+    original[num_strings].key = (uint8_t *) x;
+    original[num_strings].len = slen(x);
+    x += original[num_strings].len;
+
+    /* containers do not store empty strings */
+    if(original[num_strings].len != 0) num_strings++;
+  }
+
+  by_qsort = malloc(num_strings * sizeof(ptr_struct));
+  by_container_sort = malloc(num_strings * sizeof(ptr_struct));
+  by_cached_sort = malloc(num_strings * sizeof(ptr_struct));
+  if(by_qsort == NULL || by_container_sort == NULL || by_cached_sort == NULL) fatal(MEMORY_EXHAUSTED);
+
+  check_shared_prefix();
+
+  printf("%-10s %-16s %-18s %-18s %s\n", "limit", "tuned_qsort(s)", "container_sort(s)", 
+         "cached_sort(s)", "speedup");
+
+  for(limit=64; limit<=512; limit<<=1)
+  {
+    double qsort_time = time_sort(tuned_qsort, by_qsort, original, num_strings, limit, repetitions);
+    double container_sort_time = time_sort(container_sort, by_container_sort, original, num_strings, limit, repetitions);
+    double cached_sort_time = time_sort(container_sort_cached, by_cached_sort, original, num_strings, limit, repetitions);
+    double fastest = (container_sort_time < cached_sort_time) ? container_sort_time : cached_sort_time;
+
+    check_sorts(by_qsort, by_container_sort, by_cached_sort, num_strings);
+
+    printf("%-10lu %-16.3f %-18.3f %-18.3f %.2fx\n", limit, qsort_time, container_sort_time, 
+           cached_sort_time, qsort_time / fastest);
+  }
+
+  free(original);
+  free(by_qsort);
+  free(by_container_sort);
+  free(by_cached_sort);
+  free(buffer);
+  return 0;
+}
@@ -9,9 +9,13 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 
 #define MEMORY_EXHAUSTED   "Out of memory"
 #define BAD_INPUT          "Can not open or read file"
+#define BAD_OPTION         "Unknown or incomplete option"
+#define BAD_OUTPUT         "Can not write output"
 #define TO_MB 1000000
 #define CACHE_LINE_SIZE 128
 
@@ -19,9 +23,14 @@ typedef struct timeval timer;
 
 #define false 0
 #define true 1
-#define MIN_RANGE (char)32
-#define MAX_RANGE (char)126
-#define TRIE_SIZE 1024
+/* a trie node has a slot for each unsigned byte value, indexed by the byte, 
+ * followed by the number of strings it consumed. The null and newline 
+ * characters end a string, so slot 0 is never traversed and is free to hold
+ * the list of records of a trie node, and slot '\n' stays empty.
+ */
+#define MIN_RANGE 1
+#define MAX_RANGE 256
+#define TRIE_SIZE ((MAX_RANGE+1)*sizeof(char *))
 
 #define SKIPPING /* dont change */
 #define MASK     /* best not to turn off mask */
@@ -30,15 +39,50 @@ typedef struct timeval timer;
 #define _32_BYTES 32
 #define _64_BYTES 64
 
+/* a cursor over the distinct strings of a burst trie, in sorted order */
+typedef struct burst_cursor
+{
+  char *key;
+  uint32_t len;
+  uint64_t count;
+  char *container;
+  uint32_t depth;
+  uint32_t offset;
+  uint64_t version;
+  uint32_t started;
+}
+burst_cursor;
+
 double perform_insertion(char *to_insert);
+double perform_streaming_insertion(char *to_insert);
 double perform_search(char *to_search);
 void fatal(char *str); 
 int32_t scmp(const char  *s1, const char  *s2);
 int32_t sncmp(const char *s1, const char *s2, uint64_t, uint64_t);
-int32_t get_inserted();
-int32_t get_found();
-void set_terminator(char *buffer, int length);
+uint64_t get_inserted();
+uint64_t get_found();
+void count_inserted(uint64_t num);
+char *load_file(char *filename, uint64_t *size);
+char *map_file(char *filename, uint64_t *size);
+void unmap_file(char *buffer, uint64_t size);
+void set_terminator(char *buffer, uint64_t length);
+char *find_separator(char *x, char *end);
 int slen(char *word);
+int insert(char *word);
+int insert_with_len(char *word, uint32_t len);
+int search(char *word);
+uint64_t lookup(char *word, uint32_t len);
+int64_t lower_bound(char *word, uint32_t len, char *result);
+uint64_t prefix_count(char *prefix, uint32_t len);
+void cursor_init(burst_cursor *cursor, char *key);
+int cursor_next(burst_cursor *cursor);
+void output_init(int32_t file);
+void output_flush();
+void output_block(char *data, uint64_t length);
+void output_string(char *prefix, uint32_t prefix_len, char *suffix, uint32_t suffix_len);
+void output_repeat(char *str, uint32_t len, uint64_t num);
+uint64_t output_finish();
+uint64_t cache_size(uint32_t level);
 void node_cpy(uint32_t *dest, uint32_t *src, uint32_t bytes);
 
 
@@ -41,15 +41,68 @@
  * to fit into the L2 cache of a typical CPU, as is the intention of the       *
  * burst sort algorithm. Instead, much like my implementation of the array     *
  * burst trie and HAT-trie, containers are burst once they store more than a   *
- * given number of strings.                                                    *
+ * given number of strings. The --burst-bytes option also bursts a container   *
+ * once its strings outgrow a number of bytes, which can be taken from the     *
+ * size of a cache.                                                            *
+ *                                                                             *
+ * Containers are sorted with the multikey quicksort in container_sort.c.      *
+ * Compile with -DTUNED_QSORT to use tuned_qsort() from sort_module.o instead, *
+ * or with -DCACHED_PREFIX_SORT to sort through records that cache eight       *
+ * bytes of each string, to avoid cache misses during comparisons.             *
+ *                                                                             *
+ * Strings are sorted by their unsigned bytes, as with LC_ALL=C sort. A string *
+ * can hold any byte other than the newline and null characters, which end it, *
+ * so UTF-8 and other 8-bit input is sorted as it is.                          *
  *                                                                             *
  * (Usage: ./naskitis_copybased-burst_sort                                     *
  *                                [container-size] [number-of-files-to-insert] *
- *                                [file1] [file2] ... )                        *
+ *                                [file1] [file2] ... [options] )              *
+ * Options:                                                                    *
+ *   --threads n     build and sort with n worker threads                      *
+ *   --shared n      insert with n threads into a single shared burst trie     *
+ *   --shards n      insert with n threads into burst tries of their own, and  *
+ *                   merge the tries once every file has been inserted         *
+ *   --stream        read each file on a background thread while inserting     *
+ *                   (serial build only)                                       *
+ *   --memory-budget n                                                         *
+ *                   sort the burst trie into a run file whenever it exceeds   *
+ *                   n megabytes, and merge the runs (serial build only)       *
+ *   --key-field k   sort lines of tab-separated fields on field k, and write  *
+ *                   out the whole lines (serial build only)                   *
+ *   --permutation   write out the index of each line, in sorted order, as a   *
+ *                   binary array of 64-bit integers (implies --key-field 1)   *
+ *   --burst-bytes n burst a container once its strings occupy more than n     *
+ *                   bytes, as well as once it holds more than container-size  *
+ *                   strings. n may be L1, L2 or L3, for half the size of that *
+ *                   data cache, as reported by sysfs                          *
+ *   --sample n      build the upper levels of the burst trie from every nth   *
+ *                   string, before inserting (serial build only)              *
+ *   --unique        write out each distinct string once (as with sort -u)     *
+ *   --count         write out each distinct string once, preceded by the      *
+ *                   number of times it occurs (as with sort | uniq -c)        *
+ *   --head K        write out only the first K strings in sorted order, and   *
+ *                   release the rest of the burst trie without sorting it     *
+ *   --range lo hi   write out only the strings from lo to hi inclusive, and   *
+ *                   release the rest of the burst trie without sorting it     *
+ *   --search file   search the built burst trie for each string of file, and  *
+ *                   count the strings found (serial build only)               *
+ *   --save file     once built, save the burst trie, with its containers      *
+ *                   sorted, into a snapshot file (not with --unique alone,    *
+ *                   which keeps too few copies of each string; use --count)   *
+ *   --load file     map a snapshot file instead of building a burst trie, and *
+ *                   search it or write it out (with 0 files to insert)        *
+ *   --pointers      run the pointer-based variant: keep the input mapped, and *
+ *                   store long suffixes as a cached prefix and a pointer      *
+ *                   (serial build only)                                       *
  * Output: (printed to stderr)                                                 *
- * Copybased burst sort 520.94 446.67 12.60 28772169 64 ...                    *
+ * Copybased burst sort 520.94 446.67 12.60 28772169 64 9.80 31.42 0 ...       *
  * [algo]               [virtual mem] [estimated mem] [time to build]          *
- *                      [num keys inserted] [container size] ...               *
+ *                      [num keys inserted] [container size]                   *
+ *                      [time to sort and output] [output MB/s]                *
+ *                      [container byte limit, or 0] [containers burst]        *
+ *                      [MB copied by bursts] [trie nodes built from a sample] *
+ *                      [time to search] [strings found]                       *
+ *                      ...                                                    *
  * // End statement                                                            *
  ******************************************************************************/
 
@@ -57,31 +110,92 @@
 #include "sort_module.h"
 
 #include <assert.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
-#define BUCKET_OVERHEAD (2 + sizeof(uint32_t))
-#define STRING_EXHAUST_TRIE 31
+#define BUCKET_OVERHEAD (2 + 3*sizeof(uint32_t))
+#define STRING_EXHAUST_TRIE MAX_RANGE
 #define STRING_EXHAUST_CONTAINER 2
 #define CONSUMED 0
 #define ALLOC_OVERHEAD 16
 
+/* the container header also records the number of bytes occupied by the
+ * length-encoded strings (excluding the end-of-container flag) and the 
+ * number of strings stored, so that appending is constant time 
+ */
+#define CONTAINER_SIZE 6
+#define CONTAINER_COUNT 10
+
+/* a container that has been searched keeps its strings in sorted order, and
+ * is flagged as sorted until another string is appended to it 
+ */
+#define SORTED 1
+
+/* child pointers to trie nodes are tagged, see is_it_a_trie() */
+#define TRIE_TAG 1
+#define TAG_TRIE(x)   ((char *) ((uintptr_t) (x) | TRIE_TAG))
+#define UNTAG_TRIE(x) ((char **) ((uintptr_t) (x) & ~(uintptr_t) TRIE_TAG))
+
+/* the number of trie nodes stored in each pack (slab) of trie nodes, which
+ * keeps a pack at about 32MB. Compile with -DTRIE_PACK_ENTRIES=n to change 
+ * the size of a pack, and with -DHUGE_PAGES to back each pack with 
+ * transparent huge pages.
+ */
+#ifndef TRIE_PACK_ENTRIES
+#define TRIE_PACK_ENTRIES 16384
+#endif
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+/* with paging, container blocks of up to CONTAINER_CLASS_LIMIT bytes are carved
+ * out of slabs of CONTAINER_SLAB_SIZE bytes. There is one size class for the 
+ * 32-byte block and one for each multiple of 64 bytes. Larger blocks are left
+ * to malloc, which can coalesce them; free lists of large blocks would otherwise
+ * hold on to memory that growing containers no longer need.
+ */
+#define CONTAINER_SLAB_SIZE (2*1024*1024)
+#define CONTAINER_CLASS_LIMIT 512
+
+/* the burst trie is built by a single thread. In a parallel build, each worker 
+ * thread builds its own burst trie, so the variables that maintain a burst trie 
+ * are thread-local.
+ */
+
 /* array of pointers used to sort a bucket */
-ptr_struct *str_ptr;
+__thread ptr_struct *str_ptr;
 
 /* stores the path of characters encountered as you traverse a trie */
-char *path;
+__thread char *path;
 
 /* variables needed to maintain trie nodes */
-char **trie_pack=NULL;
-uint32_t trie_pack_idx=0;
-uint32_t trie_counter=0;
-uint32_t trie_pack_entry_capacity=32768;
-uint32_t trie_pack_capacity=256;
-uint32_t total_trie_pack_memory=0;
+__thread char **trie_pack=NULL;
+__thread uint32_t trie_pack_idx=0;
+__thread uint32_t trie_counter=0;
+uint32_t trie_pack_entry_capacity=TRIE_PACK_ENTRIES;
+__thread uint32_t trie_pack_capacity=256;
+uint64_t total_trie_pack_memory=0;
+__thread char **container_slab=NULL;
+__thread char *container_free_list[(CONTAINER_CLASS_LIMIT>>6)+1];
+__thread uint64_t container_free_map[((CONTAINER_CLASS_LIMIT>>6)>>6)+1];
+__thread uint32_t container_slab_idx=0;
+__thread uint32_t container_slab_used=0;
+__thread uint32_t container_slab_capacity=256;
 char *trie_buffer;
 char *current_bucket;
-char *root_trie;
+__thread char *root_trie;
+
+/* a container is built, or burst into a trie node, in a private slot before it
+ * is installed into a shared burst trie or merged into another burst trie 
+ */
+__thread char *private_slot[MAX_RANGE];
 
 uint64_t BUCKET_SIZE_LIM=35;
+
+/* containers can also be burst once their strings occupy more than 
+ * BUCKET_BYTE_LIM bytes, so that a container of long strings still fits 
+ * within a given cache when it is sorted. By default, only the number of
+ * strings is limited.
+ */
+uint32_t BUCKET_BYTE_LIM=UINT32_MAX;
 uint64_t inserted=0;
 uint64_t searched=0;
 uint64_t depth=0;
@@ -91,31 +205,351 @@ uint64_t trie_buffer_capacity = 65536;
 uint64_t trie_buffer_size = 0;
 uint64_t bucket_mem=0;
 uint64_t max_trie_depth=0;
+
+/* the number of containers burst, and the bytes of strings that they held, 
+ * which are copied into new containers by split_container(). Each thread 
+ * counts its own, and adds them to the totals once its burst trie is released.
+ */
+__thread uint64_t thread_bursts=0;
+__thread uint64_t thread_burst_bytes=0;
+uint64_t num_bursts=0;
+uint64_t burst_bytes=0;
 uint64_t depth_accumulator=0;
 uint64_t mtf_counter=0;
 
+/* in record mode, each string is the key field of a record (a line of tab-
+ * separated fields), and each string in a container is followed by a reference
+ * to its record: the offset of the record across the input files, or, to 
+ * output a permutation, the index of the record. The input files stay mapped
+ * until the records have been written out in the order of their keys.
+ *
+ * In count mode, each string in a container is followed by the number of
+ * times it was inserted instead. Either way, the reference_size bytes that
+ * follow a string are carried along with it when its container is burst.
+ */
+uint32_t key_field=0;
+uint32_t permutation_output=0;
+uint32_t unique_output=0;
+uint32_t count_output=0;
+
+/* compacting a container whose strings are mostly distinct only delays its 
+ * burst, so after each compaction that fails to halve a container, the number
+ * of full containers burst before the next compaction is doubled, up to 
+ * MAX_COMPACT_INTERVAL. A compaction that succeeds resets the interval.
+ */
+#define MAX_COMPACT_INTERVAL 64
+uint32_t compact_interval=1;
+uint32_t compact_countdown=0;
+
+/* with partial output, only the first head_remaining strings, or only the 
+ * strings between range_lo and range_hi inclusive, are written out. Subtries
+ * and containers that cannot hold such a string are released without being
+ * sorted.
+ */
+uint32_t partial_output=0;
+uint64_t head_remaining=UINT64_MAX;
+char *range_lo=NULL, *range_hi=NULL;
+uint32_t range_lo_len=0, range_hi_len=UINT32_MAX;
+uint32_t reference_size=0;
+uint64_t current_reference=0;
+char **record_data=NULL;
+uint64_t *record_size=NULL;
+uint64_t *record_base=NULL;
+uint32_t num_record_files=0;
+uint64_t record_bytes=0;
+uint64_t num_records=0;
+
+/* in the pointer-based variant, the input files also stay mapped, and a
+ * container stores a long suffix as a cached prefix of POINTER_PREFIX bytes
+ * followed by a pointer to the suffix in the input. Suffixes no longer than
+ * the prefix and pointer together are copied, as in the copy-based variant, 
+ * so a string never occupies more room than it would if it were copied. When
+ * a container is burst, the first byte of the cached prefix picks the child of
+ * each string, but the rest of the suffix is re-read from the input, through
+ * the pointer, to store it in the child container.
+ */
+#ifndef POINTER_PREFIX
+#define POINTER_PREFIX 8
+#endif
+#if POINTER_PREFIX < 1
+#error "POINTER_PREFIX must be at least 1, since a container is split on the first byte it stores"
+#endif
+#define POINTER_INLINE_LIMIT (POINTER_PREFIX + sizeof(char *))
+
+uint32_t pointer_based=0;
+
+/* return the number of bytes a suffix of a given length occupies in a container */
+static inline uint32_t stored_length(uint32_t len)
+{
+  return (pointer_based && len > POINTER_INLINE_LIMIT) ? POINTER_INLINE_LIMIT : len;
+}
+
+/* return the suffix that a string stored in a container refers to */
+static inline char * stored_suffix(char *x, uint32_t len)
+{
+  char *suffix=x;
+
+  if(pointer_based && len > POINTER_INLINE_LIMIT) memcpy(&suffix, x+POINTER_PREFIX, sizeof(char *));
+  return suffix;
+}
+
+/* decode the length of the string stored at x in a container, and return a 
+ * pointer to the bytes stored for the string 
+ */
+static inline char * read_entry(char *x, uint32_t *len)
+{
+  if( ( *len = (unsigned char) x[0] ) < 128 ) return x+1;
+
+  *len = (uint32_t) ( ( x[0] & 0x7f ) << 8 ) | (unsigned char) x[1];
+  return x+2;
+}
+
+/* with a memory budget, the serial build sorts its burst trie into a run file
+ * and starts a new burst trie, before the memory allocated to the trie would
+ * exceed the budget. The allocators raise over_budget as soon as their next 
+ * pack of trie nodes or slab of containers would not fit within the budget, 
+ * and the next insertion spills the trie before it needs the allocation. The
+ * runs are merged once every file has been inserted.
+ */
+uint64_t memory_budget=0;
+uint32_t over_budget=0;
+uint64_t large_container_memory=0;
+uint64_t peak_partition_memory=0;
+int32_t *run_file=NULL;
+uint32_t num_runs=0;
+uint32_t run_capacity=0;
+
+/* return the memory currently allocated to the burst trie: its packs of trie
+ * nodes, its slabs of containers, and containers allocated with malloc
+ */
+static inline uint64_t trie_memory_in_use()
+{
+  return (uint64_t) (trie_pack_idx+1) * trie_pack_entry_capacity * TRIE_SIZE +
+         (uint64_t) (container_slab_idx+1) * CONTAINER_SLAB_SIZE + large_container_memory;
+}
+
+/* raise over_budget once the burst trie, along with its next allocation, would
+ * outgrow the memory budget 
+ */
+static inline void check_memory_budget(uint64_t next_allocation)
+{
+  if(memory_budget != 0 && trie_memory_in_use() + next_allocation > memory_budget) over_budget=1;
+}
+
 void destroy();
+void release_trie();
+uint64_t snapshot_lookup(char *, uint32_t);
+extern char *snapshot;
+extern uint64_t snapshot_size;
+void save_snapshot(char *);
+double load_snapshot(char *);
+void release_snapshot();
+void output_snapshot();
+void spill_run();
+void merge_runs();
+uint32_t sort_container(char *);
+uint32_t container_entries(char *);
+uint64_t container_memory(char *);
 void split_container(char *, char **);
-void burst_container(char *, char, char **);
+void burst_container(char *, unsigned char, char **);
+void merge_trie(char **, char **);
 void resize_container(char **, uint32_t, uint32_t);
 	
-uint32_t add_to_bucket_no_search(char *bucket,  
-                     char path, 
-		     char *query_start, 
-		     char **c_trie);
-		     
 uint32_t add_to_bucket_no_search_with_len(char *bucket,  
-                     char path, 
+                     unsigned char path, 
 		     char *query_start, 
-		     char **c_trie, int len);
+		     char **c_trie, int len, char *reference);
+void add_exhausted_record(char **c_trie, char *reference);
+uint32_t compact_container(char **c_trie, unsigned char path);
+
+/* return the size of the block that a container of the given number of bytes
+ * occupies: a single 32-byte block, or as many 64-byte blocks as required 
+ */
+static inline uint32_t container_block_size(uint32_t bytes)
+{
+#ifdef EXACT_FIT
+  return bytes;
+#else
+  if(bytes <= _32_BYTES) return _32_BYTES;
+  return ((int)( (bytes-1) >> 6) + 1) << 6;
+#endif
+}
+
+/* push a free block onto the free list of its size class, and mark the class
+ * as non-empty in the bitmap of free lists 
+ */
+static inline void push_container_block(char *x, uint32_t class)
+{
+  *(char **)x = *(container_free_list+class);
+  *(container_free_list+class) = x;
+  container_free_map[class>>6] |= (uint64_t) 1 << (class & 63);
+}
+
+/* pop a block from the non-empty free list of a size class */
+static inline char * pop_container_block(uint32_t class)
+{
+  char *x = *(container_free_list+class);
+
+  if( (*(container_free_list+class) = *(char **)x) == NULL)
+    container_free_map[class>>6] &= ~((uint64_t) 1 << (class & 63));
+
+  return x;
+}
+
+/* return the smallest size class larger than the one given that has a free
+ * block, or 0 if there is none 
+ */
+static inline uint32_t find_larger_container_class(uint32_t class)
+{
+  uint32_t i = (class+1) >> 6;
+  uint64_t bits = container_free_map[i] & (~(uint64_t) 0 << ((class+1) & 63));
+
+  while(bits == 0)
+  {
+    if(++i > ((CONTAINER_CLASS_LIMIT>>6)>>6)) return 0;
+    bits = container_free_map[i];
+  }
+  return (i << 6) + __builtin_ctzll(bits);
+}
+
+/* allocate a block of memory for a container. With paging, blocks are carved out
+ * of large slabs and recycled through a free list per block size, rather than 
+ * being allocated and freed through malloc. When its own free list is empty, a
+ * block of 64 bytes or more is split from the smallest larger free block, with
+ * the remainder returned to its free list. Blocks larger than the largest size
+ * class are allocated with malloc.
+ */
+char * new_container_block(uint32_t block_size)
+{
+  char *x;
+
+#ifndef EXACT_FIT
+  if(block_size <= CONTAINER_CLASS_LIMIT)
+  {
+    uint32_t class = block_size >> 6;
+    uint32_t larger_class;
+
+    /* recycle a block of the same size if one has been freed */
+    if( *(container_free_list+class) != NULL)
+    {
+      return pop_container_block(class);
+    }
+
+    /* otherwise, split a larger free block */
+    if(class != 0 && (larger_class = find_larger_container_class(class)) != 0)
+    {
+      x = pop_container_block(larger_class);
+      push_container_block(x + block_size, larger_class - class);
+      return x;
+    }
+
+    /* otherwise, carve the block out of the current slab */
+    if(container_slab_used + block_size > CONTAINER_SLAB_SIZE)
+    {
+      if(container_slab_idx+1 == container_slab_capacity)
+      {
+        char **tmp = realloc(container_slab, (container_slab_capacity << 1) * sizeof(char *));
+        if(tmp == NULL) fatal(MEMORY_EXHAUSTED);
+
+        container_slab = tmp;
+        container_slab_capacity <<= 1;
+      }
+
+      x = malloc(CONTAINER_SLAB_SIZE);
+      if(x == NULL) fatal(MEMORY_EXHAUSTED);
+
+      *(container_slab + (++container_slab_idx)) = x;
+      container_slab_used = 0;
+      check_memory_budget(0);
+    }
+
+    x = *(container_slab+container_slab_idx) + container_slab_used;
+    container_slab_used += block_size;
+
+    /* once the largest block may no longer fit, the next may need a new slab */
+    if(CONTAINER_SLAB_SIZE - container_slab_used < CONTAINER_CLASS_LIMIT) 
+      check_memory_budget(CONTAINER_SLAB_SIZE);
+    return x;
+  }
+#endif
+
+  x = malloc(block_size);
+  if(x == NULL) fatal(MEMORY_EXHAUSTED);
+
+  if(memory_budget != 0)
+  {
+    large_container_memory += block_size;
+    check_memory_budget(0);
+  }
+  return x;
+}
+
+/* release a block of memory that was allocated to a container */
+void free_container_block(char *x, uint32_t block_size)
+{
+#ifndef EXACT_FIT
+  if(block_size <= CONTAINER_CLASS_LIMIT)
+  {
+    push_container_block(x, block_size >> 6);
+    return;
+  }
+#endif
+
+  if(memory_budget != 0) large_container_memory -= block_size;
+  free(x);
+}
+
+/* release a container, using the size recorded in its header to find its block */
+void free_container(char *bucket)
+{
+  uint32_t array_size = *(uint32_t *)(bucket+CONTAINER_SIZE);
+  free_container_block(bucket, container_block_size(array_size + 1 + BUCKET_OVERHEAD));
+}
+
+/* release a container that was traversed by a thread other than the one that
+ * built it. Blocks within a size class belong to the slabs of the thread that
+ * built the container, and are released along with its slabs.
+ */
+void free_traversed_container(char *bucket)
+{
+  uint32_t block_size = container_block_size(*(uint32_t *)(bucket+CONTAINER_SIZE) + 1 + BUCKET_OVERHEAD);
+
+#ifndef EXACT_FIT
+  if(block_size <= CONTAINER_CLASS_LIMIT) return;
+#endif
+
+  free(bucket);
+}
+
+/* release all slabs of container blocks at once, and return the number of 
+ * bytes that they occupied 
+ */
+uint64_t free_container_slabs()
+{
+  int i=0;
+  uint64_t slab_memory=0;
+
+  for(i=0; i<=container_slab_idx; i++)
+  {
+    slab_memory += CONTAINER_SLAB_SIZE + ALLOC_OVERHEAD;
+    free( *(container_slab+i) );
+  }
+  free(container_slab);
+  container_slab=NULL;
+
+  /* the free lists point into the slabs just released */
+  memset(container_free_list, 0, sizeof(container_free_list));
+  memset(container_free_map, 0, sizeof(container_free_map));
+
+  return slab_memory;
+}
 
 /* resize a container, using the techniques I developed for the array hash table */
 void resize_container(char **bucket, uint32_t array_offset, uint32_t required_increase)
 {
     #ifdef EXACT_FIT
 
-    char *tmp = malloc(array_offset + required_increase + BUCKET_OVERHEAD );
-    if(tmp == NULL) fatal (MEMORY_EXHAUSTED);
+    char *tmp = new_container_block(array_offset + required_increase + BUCKET_OVERHEAD );
 
     /* copy the existing array into the new one */
     if(array_offset==0)  
@@ -130,134 +564,112 @@ void resize_container(char **bucket, uint32_t array_offset, uint32_t required_in
 
     /* free the old array and assign the container pointer to the new array */ 
     free( *bucket );
-    *bucket = tmp;
+    __atomic_store_n(bucket, tmp, __ATOMIC_RELEASE);
  
     /* else grow the array in blocks or pages */
     #else 
 
-    if(array_offset==0)
-    {
-      /* otherwise, grow the array with paging */
-      /* if the required space is less than 32 bytes, than allocate a 32 byte block */
-      if(required_increase + BUCKET_OVERHEAD <= _32_BYTES)
-      {
-        char *tmp = malloc(_32_BYTES);
-        if(tmp == NULL) fatal (MEMORY_EXHAUSTED);
-
-        memcpy(tmp, *bucket, array_offset+BUCKET_OVERHEAD);
-
-        /* free the old array and assign the container pointer to the new array */ 
-        free( *bucket );
-        *bucket = tmp; 
-      }
-      /* otherwise, allocate as many 64-byte blocks as required */
-      else
-      {
-        uint32_t number_of_blocks = ((int)( (required_increase - 1 + BUCKET_OVERHEAD) >> 6)+1);   
-
-        char *tmp = malloc(number_of_blocks << 6);
-        if(tmp == NULL) fatal (MEMORY_EXHAUSTED);
-
-        memcpy(tmp, *bucket, array_offset+BUCKET_OVERHEAD);
-
-        /* free the old array and assign the container pointer to the new array */ 
-        free( *bucket );
-        *bucket = tmp; 
-      }
-
-      return;
-    }
-
     uint32_t old_array_size = array_offset + 1 + BUCKET_OVERHEAD;
     uint32_t new_array_size = (array_offset + required_increase + BUCKET_OVERHEAD);
-    
-    /* if the new array size can fit within the previously allocated 32-byte block, 
+
+    /* containers are allocated in a 32-byte block, then in as many 64-byte blocks
+     * as required. If the new array size still fits within the current block, 
      * then no memory needs to be allocated.
      */
-    if ( old_array_size <= _32_BYTES  &&  new_array_size <= _32_BYTES )
+    uint32_t old_block_size = container_block_size(old_array_size);
+    uint32_t new_block_size = container_block_size(new_array_size);
+
+    if(new_block_size > old_block_size)
     {
-      return;
-    }
-    /* if the new array size can fit within a 64-byte block, then allocate only a
-     * single 64-byte block.
-     */
-    else if ( old_array_size <= _32_BYTES  &&  new_array_size <= _64_BYTES)
-    {  
-      char *tmp = malloc(_64_BYTES);
-      if(tmp == NULL) fatal (MEMORY_EXHAUSTED);
-      
-      /* copy the old array into the new */
-      memcpy(tmp, *bucket, old_array_size);
-      
-      /* delete the old array */ 
-      free( *bucket );
+      char *tmp = new_container_block(new_block_size);
 
-      /* assign the container pointer to the new array */
-      *bucket = tmp;
+      /* copy the old array, a word at a time, into a new array */
+      node_cpy( (uint32_t *) tmp, (uint32_t *) *bucket, old_block_size);
 
-      return;
+      /* free the old array and assign the container pointer to the new array */ 
+      free_container_block( *bucket, old_block_size );
+      __atomic_store_n(bucket, tmp, __ATOMIC_RELEASE);
     }
-    /* if the new array size can fit within a 64-byte block, then return */
-    else if  (old_array_size <= _64_BYTES && new_array_size <= _64_BYTES )
-    {
-      return;
-    }
-    /* resize the current array by as many 64-byte blocks as required */
-    else
-    {
-      uint32_t number_of_blocks = ((int)( (old_array_size-1) >> 6) + 1);
-      uint32_t number_of_new_blocks = ((int)( (new_array_size-1) >> 6) + 1);
-
-      if(number_of_new_blocks > number_of_blocks)
-      {
-        /* allocate as many blocks as required */
-        char *tmp = malloc(number_of_new_blocks << 6);
-        if (tmp==NULL) fatal(MEMORY_EXHAUSTED);
-        
-        /* copy the old array, a word at a time, into a new array */
-        node_cpy( (uint32_t *) tmp, (uint32_t *) *bucket, number_of_blocks<<6); 
-        
-        /* free the old array */
-        free( *bucket );
-        
-        /* assign the container pointer to the new array */
-        *bucket = tmp;
-      } 
-    } 
 
   #endif 
 }	     
     
-/* need to implement if it runs of out packs. See source of HAT-trie for more details. */
+/* allocate a zeroed pack of trie nodes. With HUGE_PAGES, the pack is mapped 
+ * directly and advised to use transparent huge pages, to reduce TLB misses
+ * as insert() chases pointers from one trie node to the next.
+ */
+char * new_trie_pack()
+{
+  char *pack;
+  uint64_t pack_size = (uint64_t) trie_pack_entry_capacity*TRIE_SIZE;
+
+#ifdef HUGE_PAGES
+  pack_size = (pack_size + HUGE_PAGE_SIZE - 1) & ~((uint64_t) HUGE_PAGE_SIZE - 1);
+  pack = mmap(NULL, pack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(pack == MAP_FAILED) fatal(MEMORY_EXHAUSTED);
+  madvise(pack, pack_size, MADV_HUGEPAGE);
+#else
+  pack = calloc(pack_size, sizeof(char));
+  if(pack == NULL) fatal(MEMORY_EXHAUSTED);
+#endif
+
+  return pack;
+}
+
+/* release a pack of trie nodes */
+void free_trie_pack(char *pack)
+{
+#ifdef HUGE_PAGES
+  uint64_t pack_size = (uint64_t) trie_pack_entry_capacity*TRIE_SIZE;
+  munmap(pack, (pack_size + HUGE_PAGE_SIZE - 1) & ~((uint64_t) HUGE_PAGE_SIZE - 1));
+#else
+  free(pack);
+#endif
+}
+
+/* allocate a trie node from the current pack. Once the pack is full, a new pack 
+ * is allocated, and the array of packs is doubled in size whenever it runs out 
+ * of room, so the number of trie nodes is only bounded by memory. 
+ */
 char * new_trie()
 {
+  char *x;
+
   if(trie_counter == trie_pack_entry_capacity)
   {
     trie_pack_idx++;
-    assert(trie_pack_idx<128);
 
-    *(trie_pack+trie_pack_idx) = calloc(trie_pack_entry_capacity*TRIE_SIZE, sizeof(char));
+    if(trie_pack_idx == trie_pack_capacity)
+    {
+      char **tmp = realloc(trie_pack, (trie_pack_capacity << 1) * sizeof(char *));
+      if(tmp == NULL) fatal(MEMORY_EXHAUSTED);
+
+      trie_pack = tmp;
+      trie_pack_capacity <<= 1;
+    }
+
+    *(trie_pack+trie_pack_idx) = new_trie_pack();
     trie_counter=0;
+    check_memory_budget(0);
   }
 
-  return *(trie_pack + trie_pack_idx) + (trie_counter++ * TRIE_SIZE);
+  x = *(trie_pack + trie_pack_idx) + (trie_counter++ * TRIE_SIZE);
+
+  /* once the pack is full, the next trie node needs a new pack */
+  if(trie_counter == trie_pack_entry_capacity) 
+    check_memory_budget((uint64_t) trie_pack_entry_capacity*TRIE_SIZE);
+  return x;
 }
 
 
-/* take a pointer and return 1 if it points to a trie node.  This can
- * be determined by checking whether the address lies within the blocks
- * of memory used to store the trie nodes 
+/* take a pointer and return 1 if it points to a trie node.  Trie nodes are
+ * word-aligned within their packs, so a parent stores a pointer to a child
+ * trie node with its lowest bit set. This distinguishes trie nodes from
+ * containers in constant time, without touching memory. 
  */
-int is_it_a_trie(char *x)
+static inline int is_it_a_trie(char *x)
 {
-  register int idx=0;
-  for(; idx <= trie_pack_idx; idx++)
-  { 
-     if ( x >= *(trie_pack+idx) && x <= (*(trie_pack+idx)+(TRIE_SIZE * (trie_pack_entry_capacity-1) )) ) 
-       return 1;
-  } 
-
-  return 0;
+  return ((uintptr_t) x & TRIE_TAG);
 }
 
 /* initialize the burst trie structure */
@@ -270,86 +682,46 @@ void init()
    * blocks of memory that house the trie nodes.
    */
   trie_pack = (char **) calloc (trie_pack_capacity, sizeof(char *));
+  if(trie_pack == NULL) fatal(MEMORY_EXHAUSTED);
   trie_pack_idx=0;
   trie_counter=0;
 
   /* assign the first pointer in the trie_pack array to block of memory */ 
-  *(trie_pack+trie_pack_idx) = calloc(trie_pack_entry_capacity*TRIE_SIZE, sizeof(char));
+  *(trie_pack+trie_pack_idx) = new_trie_pack();
   
+  /* allocate the array of slabs used to house containers */
+  container_slab = (char **) calloc (container_slab_capacity, sizeof(char *));
+  if(container_slab == NULL) fatal(MEMORY_EXHAUSTED);
+  container_slab_idx=0;
+  container_slab_used=0;
+
+  *(container_slab+container_slab_idx) = malloc(CONTAINER_SLAB_SIZE);
+  if(*(container_slab+container_slab_idx) == NULL) fatal(MEMORY_EXHAUSTED);
+
   /* allocate a new trie node and assign it as the root trie node */
   root_trie=new_trie();
   c_trie = (char **)root_trie;
 
   /* make sure its pointers are null */
-  for(i=0; i<128; i++) *(c_trie+i)=NULL; 
+  for(i=0; i<MAX_RANGE; i++) *(c_trie+i)=NULL; 
 
   /* make sure you clear the string-exhaust flag in the trie node */
   *(c_trie+STRING_EXHAUST_TRIE)=0;
 }
 
-/* add a string to a container, using the techniques I developed for the HAT-trie.
- * This method simply appends a length-encoded string to the end of a bucket.
+/* write a length-encoded string, followed by its reference, into a container 
+ * array, and return the end of the entry. In the pointer-based variant, a long
+ * string is written as a prefix followed by a pointer to the string.
  */
-uint32_t add_to_bucket_no_search(char *bucket,  
-         char path, 
-		     char *query_start, 
-		     char **c_trie)
+static inline char * write_entry(char *array, char *query_start, uint32_t len, char *reference)
 {
-  char *array, *array_start, *query;
-  char *tmp=*(c_trie+path);
-    
-  char *consumed=0;
-  uint32_t array_offset;
-  uint32_t register len;
-  uint32_t num=0;
-
-  array = (char *)(bucket+BUCKET_OVERHEAD);
-  consumed = (char *)(bucket+CONSUMED);
-  
-  array_start=array;
-  query = query_start;
- 
-  /* set a flag to indicate that the bucket now stores a string */
-  if(*consumed == 0) { *consumed = 1; goto insert; }
-  
-  /* scan the container until you reach the null (end-of-bucket) character */
-  while( *array != '\0') 
-  {
-  
-    if( ( len = (unsigned int) *array ) >= 128 )
-    {
-      len = (unsigned int) ( ( *array & 0x7f ) << 8 ) |  (unsigned int) ( *(++array) & 0xff );
-    }
-    array = (array+1) + len;
-    ++num;
-  }
-
-  insert:
-
-  /* get the length of the string to insert */
-  for(; *query != '\0'; query++);
-   
-  len = query - query_start;
-
-  /* get the size of the array */
-  array_offset = array-array_start;
-
-  /* resize the array to fit the new string */
-  resize_container((char **)(c_trie+path), array_offset, ( len < 128 ) ? len+2 : len+3);
- 
-  /* reinitialize the array pointers, the point to the end of the array */
-  array = (char *)( *(c_trie+path) + BUCKET_OVERHEAD);
-  array_start=array;  
-  array += array_offset;
-
   /* if the length of the string is less than 128 characters, then only a single byte is
    * needed to store its length
    */
   if( len < 128 )
   {
     *array = (char) len;
-
-  }  
+  }
   /* if the length of the string is greater than 128 characters, then two bytes are required to
    * store the string 
    */
@@ -357,109 +729,93 @@ uint32_t add_to_bucket_no_search(char *bucket,
   {
     *array     = (char) ( len >> 8) | 0x80;
     *(++array) = (char) ( len ) & 0xff; 
-
   }
   array++;
-
-  /* copy the string into the array */ 
-  while( *query_start != '\0')
+   
+  /* copy the string into the array, or in the pointer-based variant, a prefix
+   * of a long string followed by a pointer to the string
+   */
+  if( stored_length(len) != len )
   {
-    *array++ = *query_start++;
+    memcpy(array, query_start, POINTER_PREFIX);
+    memcpy(array+POINTER_PREFIX, &query_start, sizeof(char *));
+    array += POINTER_INLINE_LIMIT;
+  }
+  else
+  {
+    memcpy(array, query_start, len);
+    array += len;
   }
 
-  /* make sure the array is null terminated */
-  *array='\0';
-  ++num;
-
-  return num;    
+  /* in record mode, the reference to the record follows the string */
+  if(reference_size != 0)
+  {
+    memcpy(array, reference, reference_size);
+    array += reference_size;
+  }
+  return array;
 }
 
 /* add a string with its length to a container, using the techniques I developed for the HAT-trie.
  * This method simply appends a length-encoded string to the end of a bucket.
  */
 uint32_t add_to_bucket_no_search_with_len(char *bucket,  
-         char path, 
+         unsigned char path, 
 		     char *query_start, 
-		     char **c_trie, int query_len)
+		     char **c_trie, int query_len, char *reference)
 {
   char *array, *array_start;
   char *tmp=*(c_trie+path);
   
   uint32_t len;
+  uint32_t num=0;
   char *consumed=0;
   uint32_t array_offset;
 
-  array    = (char *)(bucket+BUCKET_OVERHEAD);
   consumed = (char *)(bucket+CONSUMED);
-  
-  array_start=array;
 
-  /* set a flag to indicate that the bucket now stores a string */
-  if(*consumed == 0) { *consumed = 1; goto insert; }
+  /* set a flag to indicate that the bucket now stores a string, which is 
+   * appended out of order 
+   */
+  *consumed = 1;
+  *(bucket+SORTED) = 0;
    
-  /* scan the container until you reach the null (end-of-bucket) character */
-  while( *array != '\0')
-  {
-    if( ( len = (unsigned int) *array ) >= 128 )
-    {
-      len = (unsigned int) ( ( *array & 0x7f ) << 8 ) | (unsigned int) ( *(++array) & 0xff );
-    }
-    array = (array+1) + len;
-  }
-  
-  insert:
+  /* get the size of the array and the number of strings from the header */
+  array_offset = *(uint32_t *)(bucket+CONTAINER_SIZE);
+  num = *(uint32_t *)(bucket+CONTAINER_COUNT);
 
   /* get the length of the string to insert */
   len = query_len;
-  
-  /* get the size of the array */
-  array_offset = array-array_start;
    
-  /* resize the array to fit the new string */
-  resize_container((char **)(c_trie+path), array_offset, ( len < 128 ) ? len+2 : len+3);
+  /* resize the array to fit the new string, and its reference to a record */
+  resize_container((char **)(c_trie+path), array_offset, 
+                   (( len < 128 ) ? 2 : 3) + stored_length(len) + reference_size);
    
   /* reinitialize the array pointers, the point to the end of the array */
   array = (char *)( *(c_trie+path) + BUCKET_OVERHEAD);
   array_start=array;  
   array += array_offset;
-  
-  /* if the length of the string is less than 128 characters, then only a single byte is
-   * needed to store its length
-   */
-  if( len < 128 )
-  {
-    *array = (char) len;
-  }
-  /* if the length of the string is greater than 128 characters, then two bytes are required to
-   * store the string 
-   */
-  else 
-  {
-    *array     = (char) ( len >> 8) | 0x80;
-    *(++array) = (char) ( len ) & 0xff; 
-  }
-  array++;
-   
-  /* copy the string into the array */
-  while( len!=0 )
-  {
-    *array++ = *query_start++;
-    len--;
-  }
-
-  /* make sure the array is null terminated */
-  *array = '\0';
-  return 1;    
-}
-
-/* allocate a new container */
-int new_container(char **c_trie, char path, char *word)
-{
-  char *x;
+  array = write_entry(array, query_start, len, reference);
+
+  /* make sure the array is null terminated */
+  *array = '\0';
+  ++num;
+
+  /* record the new size of the array and the number of strings it stores */
+  bucket = *(c_trie+path);
+  *(uint32_t *)(bucket+CONTAINER_SIZE) = array-array_start;
+  *(uint32_t *)(bucket+CONTAINER_COUNT) = num;
+
+  return num;    
+}
+
+/* allocate a new container */
+int new_container(char **c_trie, unsigned char path, char *word, uint32_t len)
+{
+  char *x;
   
   /* allocate space for the container */
-  x=malloc(BUCKET_OVERHEAD);
-  if (x==NULL) fatal (MEMORY_EXHAUSTED);
+  x=new_container_block(container_block_size(BUCKET_OVERHEAD));
 
   /* make sure the string-exhaust flag is cleared, and the
    * bytes used to store the pointer to the head of the list is
@@ -467,60 +823,542 @@ int new_container(char **c_trie, char path, char *word)
    */
   *(x+CONSUMED)=0;
   *(uint32_t *)(x+STRING_EXHAUST_CONTAINER)=0;
+  *(uint32_t *)(x+CONTAINER_SIZE)=0;
+  *(uint32_t *)(x+CONTAINER_COUNT)=0;
 
    /* assign the parent pointer to the new container */
   *(c_trie + path)=x;
   
-  if( *word == '\0')
+  if( len == 0 && key_field == 0 )
   {
     *(uint32_t *)(x+STRING_EXHAUST_CONTAINER)=1;
   }
   else
   {
-    add_to_bucket_no_search(x, path, word, c_trie); 
+    add_to_bucket_no_search_with_len(x, path, word, c_trie, len, (char *) &current_reference); 
   }
   return 1;
 }
 
+/* in record mode, a string that is consumed by a trie node keeps a reference
+ * to its record, so rather than being counted, its reference is appended to a
+ * list assigned to slot 0 of the trie node. No string can lead to slot 0, 
+ * since the null character ends a string. The list holds the number of 
+ * references and its capacity, followed by the references, and doubles in 
+ * size when full, since it is never burst.
+ */
+void add_exhausted_record(char **c_trie, char *reference)
+{
+  uint64_t *list = (uint64_t *) *c_trie;
+
+  if(list == NULL || *list == *(list+1))
+  {
+    uint64_t capacity = (list == NULL) ? 4 : *(list+1) << 1;
+
+    list = realloc(list, (2 + capacity) * sizeof(uint64_t));
+    if(list == NULL) fatal(MEMORY_EXHAUSTED);
+
+    if(*c_trie == NULL) *list = 0;
+    *(list+1) = capacity;
+    *c_trie = (char *) list;
+  }
+  memcpy(list + 2 + *list, reference, sizeof(uint64_t));
+  (*list)++;
+}
+
+/* return the number of times the string at position j of str_ptr was inserted */
+static inline uint32_t string_count(uint32_t j)
+{
+  uint32_t count=1;
+
+  if(count_output) memcpy(&count, str_ptr[j].key + str_ptr[j].len, sizeof(uint32_t));
+  return count;
+}
+
+/* return 1 if the strings at two positions of str_ptr are equal */
+static inline int same_string(uint32_t j, uint32_t k)
+{
+  return str_ptr[j].len == str_ptr[k].len && memcmp(str_ptr[j].key, str_ptr[k].key, str_ptr[j].len) == 0;
+}
+
+/* in unique mode, replace a full container with one that stores each of its
+ * distinct strings once, along with its count in count mode, and return the
+ * number of distinct strings
+ */
+uint32_t compact_container(char **c_trie, unsigned char path)
+{
+  char *bucket = *(c_trie+path);
+  char *x;
+  uint32_t num=0, distinct=0, count=0, j=0, k=0;
+
+  num = sort_container(bucket);
+
+  x=new_container_block(container_block_size(BUCKET_OVERHEAD));
+  *(x+CONSUMED)=0;
+  *(uint32_t *)(x+STRING_EXHAUST_CONTAINER)=*(uint32_t *)(bucket+STRING_EXHAUST_CONTAINER);
+  *(uint32_t *)(x+CONTAINER_SIZE)=0;
+  *(uint32_t *)(x+CONTAINER_COUNT)=0;
+  *(c_trie+path)=x;
+
+  for(j=0; j<num; j=k)
+  {
+    for(k=j, count=0; k<num && same_string(j, k); k++) count += string_count(k);
+
+    add_to_bucket_no_search_with_len(*(c_trie+path), path, (char *) str_ptr[j].key, c_trie, 
+                                     str_ptr[j].len, (char *) &count);
+    distinct++;
+  }
+
+  free_container(bucket);
+  return distinct;
+}
+
+/* Once built, the burst trie can be searched as a sorted set of strings. A 
+ * container is sorted in place the first time that it is searched, and stays 
+ * sorted until a string is appended to it, so the strings it stores can be 
+ * binary searched through str_ptr. In unique mode without --count, the copies
+ * of a string collapsed into a container are found once.
+ */
+char *sorted_copy=NULL;
+uint32_t sorted_copy_capacity=0;
+
+/* the container, and the position of the string within it, where the last 
+ * call to lower_bound() found its string. The position is UINT32_MAX if the
+ * string was consumed by the container, and the container is NULL if the 
+ * string was consumed by a trie node. 
+ */
+char *sought_container=NULL;
+uint32_t sought_entry=0;
+
+/* the number of insertions into the burst trie, so that cursors can tell when
+ * the container they walk may have been moved or burst 
+ */
+__thread uint64_t trie_version=0;
+
+/* sort the strings of a container in place, unless it is already sorted, and
+ * assign them to str_ptr in sorted order. Return the number of strings.
+ */
+static uint32_t sorted_container(char *bucket)
+{
+  uint32_t num=0, j=0, size=*(uint32_t *)(bucket+CONTAINER_SIZE);
+  char *array;
+
+  if(*(bucket+CONSUMED) == 0) return 0;
+  if(*(bucket+SORTED) == 1) return container_entries(bucket);
+
+  num = sort_container(bucket);
+
+  /* rewrite the strings in sorted order, which occupy as many bytes as before */
+  if(size > sorted_copy_capacity)
+  {
+    sorted_copy_capacity = size;
+    if( (sorted_copy = realloc(sorted_copy, sorted_copy_capacity)) == NULL) fatal(MEMORY_EXHAUSTED);
+  }
+  for(j=0, array=sorted_copy; j<num; j++) 
+    array = write_entry(array, (char *) str_ptr[j].key, str_ptr[j].len, (char *) str_ptr[j].key + str_ptr[j].len);
+
+  memcpy(bucket+BUCKET_OVERHEAD, sorted_copy, size);
+  *(bucket+SORTED) = 1;
+  return container_entries(bucket);
+}
+
+/* compare the string at position j of str_ptr with a query string */
+static inline int compare_entry(uint32_t j, char *word, uint32_t len)
+{
+  uint32_t m = (str_ptr[j].len < len) ? str_ptr[j].len : len;
+  int r = memcmp(str_ptr[j].key, word, m);
+
+  if(r != 0) return r;
+  return (str_ptr[j].len > len) - (str_ptr[j].len < len);
+}
+
+/* return the first position of str_ptr, among num, whose string does not sort
+ * before a query string 
+ */
+static uint32_t entry_lower_bound(uint32_t num, char *word, uint32_t len)
+{
+  uint32_t lo=0, hi=num, mid=0;
+
+  while(lo < hi)
+  {
+    mid = lo + ((hi-lo) >> 1);
+    if(compare_entry(mid, word, len) < 0) lo = mid+1; else hi = mid;
+  }
+  return lo;
+}
+
+/* return the number of strings that a trie node consumed */
+static inline uint64_t trie_exhausted(char **c_trie)
+{
+  if(key_field != 0) return (*c_trie == NULL) ? 0 : *(uint64_t *) *c_trie;
+  return *(uint64_t *)(c_trie+STRING_EXHAUST_TRIE);
+}
+
+/* return the number of strings stored in a container, or consumed by it */
+static uint64_t container_total(char *bucket)
+{
+  uint64_t total = *(uint32_t *)(bucket+STRING_EXHAUST_CONTAINER);
+  uint32_t num=0, j=0;
+
+  if(*(bucket+CONSUMED) == 0) return total;
+  if(!count_output) return total + *(uint32_t *)(bucket+CONTAINER_COUNT);
+
+  num = container_entries(bucket);
+  for(j=0; j<num; j++) total += string_count(j);
+  return total;
+}
+
+/* return the number of strings stored in a subtrie */
+static uint64_t subtrie_total(char **c_trie)
+{
+  uint64_t total = trie_exhausted(c_trie);
+  unsigned int i=0;
+  char *x;
+
+  for(i=MIN_RANGE; i<MAX_RANGE; i++)
+  {
+    if ( (x = *(c_trie + i)) == NULL) continue;
+    total += is_it_a_trie(x) ? subtrie_total(UNTAG_TRIE(x)) : container_total(x);
+  }
+  return total;
+}
+
+/* return the number of times a string of a given length was inserted. Only 
+ * the characters traversed by in_order() can lead to a string.
+ */
+uint64_t lookup(char *word, uint32_t len)
+{
+  char **c_trie = (char **) root_trie;
+  uint64_t count=0;
+  uint32_t num=0, j=0;
+  unsigned char c=0;
+  char *x;
+
+  if(snapshot != NULL) return snapshot_lookup(word, len);
+
+  while( len != 0 )
+  {
+    c = (unsigned char) *word;
+    if(c < MIN_RANGE || (x = *(c_trie + c)) == NULL) return 0;
+
+    word++;
+    len--;
+
+    if( is_it_a_trie(x) ) 
+    {
+      c_trie = UNTAG_TRIE(x);
+      continue;
+    }
+
+    /* a string consumed by a container is only counted, outside record mode */
+    if( len == 0 && key_field == 0 ) return *(uint32_t *)(x+STRING_EXHAUST_CONTAINER);
+
+    num = sorted_container(x);
+    for(j=entry_lower_bound(num, word, len); j<num && compare_entry(j, word, len) == 0; j++) 
+      count += string_count(j);
+    return count;
+  }
+  return trie_exhausted(c_trie);
+}
+
 int search(char *word)
 {
-  return 0;
+  return lookup(word, slen(word)) != 0;
+}
+
+static int64_t subtrie_lower_bound(char **c_trie, char *word, uint32_t len, char *result, uint32_t depth);
+
+/* find the smallest string of a container, whose strings follow the first depth
+ * characters of result, that does not sort before a query string. Write it 
+ * into result and return its length, or return -1 if there is none.
+ */
+static int64_t container_lower_bound(char *bucket, char *word, uint32_t len, char *result, uint32_t depth)
+{
+  uint32_t num=0, j=0;
+
+  sought_container = bucket;
+  sought_entry = UINT32_MAX;
+  if(len == 0 && *(uint32_t *)(bucket+STRING_EXHAUST_CONTAINER) != 0) return depth;
+
+  num = sorted_container(bucket);
+  if( (j = entry_lower_bound(num, word, len)) == num) return -1;
+  sought_entry = j;
+
+  memcpy(result+depth, str_ptr[j].key, str_ptr[j].len);
+  return depth + str_ptr[j].len;
+}
+
+/* find the smallest string of a child of a trie node that does not sort 
+ * before a query string, as in container_lower_bound() 
+ */
+static inline int64_t child_lower_bound(char *x, uint32_t i, char *word, uint32_t len, char *result, uint32_t depth)
+{
+  result[depth]=(char)i;
+
+  if( is_it_a_trie(x) ) 
+    return subtrie_lower_bound(UNTAG_TRIE(x), word, len, result, depth+1);
+  return container_lower_bound(x, word, len, result, depth+1);
 }
 
-/* insert a string into the copy based burst sort algorithm (i.e., burst trie) */
+/* find the smallest string of a subtrie that does not sort before a query 
+ * string, as in container_lower_bound(). The query is matched against the 
+ * child it leads to, and failing that, the smallest string of the next child
+ * is taken. 
+ */
+static int64_t subtrie_lower_bound(char **c_trie, char *word, uint32_t len, char *result, uint32_t depth)
+{
+  unsigned int i=MIN_RANGE, c=0;
+  int64_t r=0;
+  char *x;
+
+  if(len == 0)
+  {
+    sought_container = NULL;
+    if(trie_exhausted(c_trie) != 0) return depth;
+  }
+  else
+  {
+    c = (unsigned char) *word;
+
+    if(c >= MIN_RANGE) 
+    {
+      if( (x = *(c_trie + c)) != NULL && (r = child_lower_bound(x, c, word+1, len-1, result, depth)) >= 0) 
+        return r;
+      i = c+1;
+    }
+  }
+
+  for(; i<MAX_RANGE; i++)
+  {
+    if ( (x = *(c_trie + i)) == NULL) continue;
+    if( (r = child_lower_bound(x, i, NULL, 0, result, depth)) >= 0) return r;
+  }
+  return -1;
+}
+
+/* find the smallest string in the burst trie that does not sort before a 
+ * query string of a given length. It is written into result, which must hold
+ * the longest string inserted, and its length is returned, or -1 if every 
+ * string sorts before the query.
+ */
+int64_t lower_bound(char *word, uint32_t len, char *result)
+{
+  return subtrie_lower_bound((char **) root_trie, word, len, result, 0);
+}
+
+/* A cursor walks the distinct strings of the burst trie in sorted order, 
+ * without releasing the trie. Each container is sorted in place once the 
+ * cursor reaches it, and is then read in order straight from the container. 
+ * Strings may be inserted between calls to cursor_next(). An insertion only 
+ * clears the sorted flag of the container it touches, but since it may move 
+ * or burst the container being walked, the cursor then seeks the string that 
+ * follows its current string with lower_bound(), from the root. 
+ */
+
+/* start a cursor, whose strings are written into key, which must hold the 
+ * longest string inserted 
+ */
+void cursor_init(burst_cursor *cursor, char *key)
+{
+  cursor->key = key;
+  cursor->len = 0;
+  cursor->count = 0;
+  cursor->container = NULL;
+  cursor->depth = 0;
+  cursor->offset = 0;
+  cursor->version = 0;
+  cursor->started = 0;
+}
+
+/* read the next distinct string of the sorted container that a cursor walks,
+ * along with the number of times it was inserted
+ */
+static void cursor_read(burst_cursor *cursor)
+{
+  char *array = cursor->container + BUCKET_OVERHEAD;
+  char *x = array + cursor->offset, *stored;
+  uint32_t size = *(uint32_t *)(cursor->container+CONTAINER_SIZE);
+  uint32_t len=0, count=0;
+
+  stored = read_entry(x, &len);
+  memcpy(cursor->key + cursor->depth, stored_suffix(stored, len), len);
+  cursor->len = len;
+  cursor->count = 0;
+
+  /* the copies of a string are adjacent in a sorted container */
+  do
+  {
+    count = 1;
+    if(count_output) memcpy(&count, stored + stored_length(len), sizeof(uint32_t));
+    cursor->count += count;
+
+    x = stored + stored_length(len) + reference_size;
+    if(x - array >= size) break;
+    stored = read_entry(x, &len);
+  }
+  while( len == cursor->len && memcmp(stored_suffix(stored, len), cursor->key + cursor->depth, len) == 0 );
+
+  cursor->offset = x - array;
+  cursor->len += cursor->depth;
+}
+
+/* advance a cursor to the next distinct string in sorted order. Return 1 and
+ * set the string, its length and the number of times it was inserted, or 
+ * return 0 once every string has been visited.
+ */
+int cursor_next(burst_cursor *cursor)
+{
+  char *x = cursor->container;
+  uint32_t j=0;
+  int64_t r=0;
+
+  /* carry on through the current container, if it was not since changed */
+  if(x != NULL && cursor->version == trie_version && 
+     cursor->offset < *(uint32_t *)(x+CONTAINER_SIZE) && *(x+SORTED) == 1)
+  {
+    cursor_read(cursor);
+    return 1;
+  }
+
+  /* otherwise, seek the smallest string greater than the current string, 
+   * which is the current string followed by a null character. The string is
+   * sought in place.
+   */
+  if(cursor->started) cursor->key[cursor->len++] = '\0';
+  r = lower_bound(cursor->key, cursor->started ? cursor->len : 0, cursor->key);
+  cursor->started = 1;
+  cursor->version = trie_version;
+
+  if(r < 0)
+  {
+    cursor->container = NULL;
+    cursor->len = 0;
+    return 0;
+  }
+
+  cursor->container = sought_container;
+  if(sought_container == NULL) 
+  {
+    cursor->len = r;
+    cursor->count = lookup(cursor->key, r);
+    return 1;
+  }
+
+  /* a string consumed by the container precedes those stored in it */
+  if(sought_entry == UINT32_MAX)
+  {
+    sorted_container(sought_container);
+    cursor->offset = 0;
+    cursor->depth = r;
+    cursor->len = r;
+    cursor->count = *(uint32_t *)(sought_container+STRING_EXHAUST_CONTAINER);
+    return 1;
+  }
+
+  /* find the offset of the string within the sorted container */
+  cursor->depth = r - str_ptr[sought_entry].len;
+  for(x = sought_container + BUCKET_OVERHEAD, j=0; j<sought_entry; j++)
+  {
+    x = read_entry(x, &cursor->len);
+    x += stored_length(cursor->len) + reference_size;
+  }
+  cursor->offset = x - (sought_container + BUCKET_OVERHEAD);
+  cursor_read(cursor);
+  return 1;
+}
+
+/* return the number of strings in the burst trie that start with a prefix of
+ * a given length, as inserted 
+ */
+uint64_t prefix_count(char *prefix, uint32_t len)
+{
+  char **c_trie = (char **) root_trie;
+  uint64_t count=0;
+  uint32_t num=0, j=0;
+  unsigned char c=0;
+  char *x;
+
+  while( len != 0 )
+  {
+    c = (unsigned char) *prefix;
+    if(c < MIN_RANGE || (x = *(c_trie + c)) == NULL) return 0;
+
+    prefix++;
+    len--;
+
+    if( is_it_a_trie(x) ) 
+    {
+      c_trie = UNTAG_TRIE(x);
+      continue;
+    }
+    if(len == 0) return container_total(x);
+
+    /* the strings that start with the prefix are adjacent once sorted */
+    num = sorted_container(x);
+    for(j=entry_lower_bound(num, prefix, len); j<num; j++) 
+    {
+      if(str_ptr[j].len < len || memcmp(str_ptr[j].key, prefix, len) != 0) break;
+      count += string_count(j);
+    }
+    return count;
+  }
+  return subtrie_total(c_trie);
+}
+
+/* insert a null-terminated string into the copy based burst sort algorithm */
 int insert(char *word)
 {
-  char **c_trie=  (char **) root_trie;
+  return insert_with_len(word, slen(word));
+}
+
+/* insert a string of a given length into the copy based burst sort algorithm 
+ * (i.e., burst trie). The length is carried down to the container, so the 
+ * string is never scanned again. 
+ */
+int insert_with_len(char *word, uint32_t len)
+{
+  char **c_trie;
   char *x; 
   int r=0;
 
+  trie_version++;
+
+  /* once the burst trie has outgrown the memory budget, spill it to a run */
+  if(over_budget)
+  {
+    spill_run();
+    init();
+  }
+  c_trie = (char **) root_trie;
+
  /* grab the leading character from the query string */
-  while( *word != '\0')
+  while( len != 0 )
   {
     /* if the pointer that maps to the leading character is null,
      * then create a new container to house the string, to complete
      * the insertion process
      */
-    if ( (x = *(c_trie +  *word)) == NULL) 
-      return new_container(c_trie, *word, word+1); 
+    if ( (x = *(c_trie + (unsigned char) *word)) == NULL) 
+      return new_container(c_trie, *word, word+1, len-1); 
          
     /* check whether the pointer that maps to the leading character 
      * leads to a trie node or to a container
      */
     if( is_it_a_trie(x) ) 
     {
-       c_trie = (char **)x;
+       c_trie = UNTAG_TRIE(x);
     }
     else
     {
       /* consume the lead character */
       word++;
+      len--;
       
       /* if the query string has been consumed entirely, then set
        * the string-exhaust flag within the current node to complete
        * the insertion 
        */
-      if( *word == '\0') 
+      if( len == 0 && key_field == 0 ) 
       { 
         *(uint32_t *)(x+STRING_EXHAUST_CONTAINER) = *(uint32_t *)(x+STRING_EXHAUST_CONTAINER) + 1;
         return 1;
@@ -531,15 +1369,34 @@ int insert(char *word)
        * then the insertion was a success. In this case, check to see
        * whether the container needs to be burst 
        */
-      if( (r=add_to_bucket_no_search(x, *(word-1), word, c_trie)) )
+      if( (r=add_to_bucket_no_search_with_len(x, *(word-1), word, c_trie, len, (char *) &current_reference)) )
       {
-        x = *(c_trie +  *(word-1));
+        x = *(c_trie + (unsigned char) *(word-1));
 
 	 /* if the number of entries in the current container exceed the
          * container limit, then the container needs to be burst 
          */
-        if( r > BUCKET_SIZE_LIM ) 
+        if( r > BUCKET_SIZE_LIM || *(uint32_t *)(x+CONTAINER_SIZE) > BUCKET_BYTE_LIM ) 
         {
+          /* in unique mode, first collapse the duplicates in the container, 
+           * and only burst it if at least half of its strings are distinct.
+           * While the strings are mostly distinct, fewer containers are 
+           * compacted, see compact_interval.
+           */
+          if(unique_output && compact_countdown-- == 0)
+          {
+            r = compact_container(c_trie, *(word-1));
+            x = *(c_trie + (unsigned char) *(word-1));
+
+            if( r <= BUCKET_SIZE_LIM/2 && *(uint32_t *)(x+CONTAINER_SIZE) <= BUCKET_BYTE_LIM/2 ) 
+            {
+              compact_interval = 1;
+              compact_countdown = 0;
+              return 1;
+            }
+            if(compact_interval < MAX_COMPACT_INTERVAL) compact_interval <<= 1;
+            compact_countdown = compact_interval-1;
+          }
 	  burst_container(x, *(word-1), c_trie);
         }
 
@@ -550,65 +1407,1419 @@ int insert(char *word)
 
     /* consume the current character and continue with the traversal */
     word++;
+    len--;
   }
 
   /* if the string was consumed prior to reaching a container, then 
    * set the string-exhaust flag within the current trie node to 
    * complete the insertion. 
    */
+  if(key_field != 0)
+  {
+    add_exhausted_record(c_trie, (char *) &current_reference);
+    return 1;
+  }
   *(uint64_t *)(c_trie+STRING_EXHAUST_TRIE) = *(uint64_t *)(c_trie+STRING_EXHAUST_TRIE) + 1;
   return 1;
 }
 
-int main(int argc, char **argv)
+/* map a file of records into memory and insert the key field of each record,
+ * along with a reference to the record. A record ends with a newline or a null
+ * character, or at the end of the file, and a record that has fewer fields 
+ * than the key field has an empty key. The pointer-based variant also inserts
+ * its files through here, with no key field, so that the whole record is the 
+ * key and the file stays mapped.
+ */
+double perform_record_insertion(char *to_insert)
 {
-   char *to_insert=NULL, *to_search=NULL;
-   int num_files=0;
-   int i=0;
-   int j=0;
-   double mem=0;
-   double insert_real_time=0.0, search_real_time=0.0;
- 
-   /* get the container limit */
-   BUCKET_SIZE_LIM = atoi(argv[1]);
+  timer start, stop;
+  double insert_real_time=0.0;
+  uint64_t size=0, num_inserted=0;
+  char *buffer, *buffer_end, *record, *record_end, *key, *key_end;
+  uint32_t field=0;
 
-   /* make sure the user supplied a valid bucket size */
-   if (BUCKET_SIZE_LIM < 64 || BUCKET_SIZE_LIM > 512)
-   {
-     puts("Keep bucket size between 128 and 256 strings, inclusive");
-     exit(1);
-   }
+  buffer = map_file(to_insert, &size);
+  buffer_end = buffer+size;
 
-   /* since the bursting limit is actually a soft-limit, we need
-    * to make room for some extra ptrs.
-    */
-   str_ptr = (ptr_struct *)calloc(BUCKET_SIZE_LIM*64, sizeof(ptr_struct *));
-   path = calloc(524288, sizeof(char));
+  record_data[num_record_files] = buffer;
+  record_size[num_record_files] = size;
+  record_base[num_record_files] = record_bytes;
+  num_record_files++;
 
-   /* get the number of files to insert */ 
-   num_files = atoi(argv[2]);
-   
-   init();
+  /* start the timer for insertion */
+  gettimeofday(&start, NULL);
 
-   /* insert the files in sequence into the standard-chain burst trie and
-    * accumulate the time required
-    */
-   for(i=0, j=3; i<num_files; i++, j++)
-   {
-     to_insert=argv[j];     
-     insert_real_time+=perform_insertion(to_insert);
-   }
+  for(record=buffer; record < buffer_end; record=record_end+1)
+  {
+    record_end = find_separator(record, buffer_end);
 
-   uint64_t vsize=0;
-   {
-     pid_t mypid;
-     FILE * statf;
-     char fname[1024];
-     uint64_t ret;
-     uint64_t pid; 
-     char commbuf[1024];
-     char state;
-     uint64_t ppid, pgrp, session, ttyd, tpgid;
+    /* find the key field of the record */
+    key = record;
+    for(field=1; field < key_field && key != NULL; field++)
+    {
+      key = memchr(key, '\t', record_end-key);
+      if(key != NULL) key++;
+    }
+    if(key == NULL) key = record_end;
+
+    if( key_field == 0 || (key_end = memchr(key, '\t', record_end-key)) == NULL) key_end = record_end;
+
+    current_reference = (permutation_output) ? num_records : record_bytes + (record-buffer);
+    num_records++;
+
+    if(insert_with_len(key, key_end-key)) num_inserted++;
+  }
+
+  /* as in perform_insertion(), an empty file holds a single empty string, 
+   * although it holds no records
+   */
+  if(size == 0 && key_field == 0)
+  {
+    if(insert_with_len("", 0)) num_inserted++;
+  }
+
+  /* stop the insertion timer */
+  gettimeofday(&stop, NULL);
+
+  insert_real_time = 1000.0 * ( stop.tv_sec - start.tv_sec ) + 0.001  
+  * (stop.tv_usec - start.tv_usec );
+  insert_real_time = insert_real_time/1000.0;
+
+  record_bytes += size;
+  count_inserted(num_inserted);
+  return insert_real_time;
+}
+
+/* compare a string, made of a prefix and a suffix, with a bound, and return
+ * a negative value, zero or a positive value as it sorts before, equal to or
+ * after the bound 
+ */
+static int compare_with_bound(char *prefix, uint32_t prefix_len, char *suffix, uint32_t suffix_len,
+                              char *bound, uint32_t bound_len)
+{
+  uint32_t m = (prefix_len < bound_len) ? prefix_len : bound_len;
+  int r = memcmp(prefix, bound, m);
+
+  if(r != 0) return r;
+  if(prefix_len >= bound_len) return (prefix_len + suffix_len > bound_len);
+
+  bound += prefix_len;
+  bound_len -= prefix_len;
+  m = (suffix_len < bound_len) ? suffix_len : bound_len;
+
+  if( (r = memcmp(suffix, bound, m)) != 0) return r;
+  return (suffix_len > bound_len) - (suffix_len < bound_len);
+}
+
+/* return 1 if a string lies within the range of partial output */
+static inline int key_in_range(char *prefix, uint32_t prefix_len, char *suffix, uint32_t suffix_len)
+{
+  if(range_lo != NULL && compare_with_bound(prefix, prefix_len, suffix, suffix_len, range_lo, range_lo_len) < 0) 
+    return 0;
+  if(range_hi != NULL && compare_with_bound(prefix, prefix_len, suffix, suffix_len, range_hi, range_hi_len) > 0) 
+    return 0;
+  return 1;
+}
+
+/* return 1 if no string that starts with a given prefix can be written out */
+static inline int subtrie_outside_range(char *path, uint32_t len)
+{
+  uint32_t m=0;
+  int r=0;
+
+  if(head_remaining == 0) return 1;
+
+  if(range_lo != NULL)
+  {
+    m = (len < range_lo_len) ? len : range_lo_len;
+    if(memcmp(path, range_lo, m) < 0) return 1;
+  }
+  if(range_hi != NULL)
+  {
+    m = (len < range_hi_len) ? len : range_hi_len;
+    if( (r = memcmp(path, range_hi, m)) > 0 || (r == 0 && len > range_hi_len)) return 1;
+  }
+  return 0;
+}
+
+/* write out a record, or its index in a permutation, given its reference */
+static inline void output_record(char *reference)
+{
+  static uint32_t i=0;
+  uint64_t r=0;
+  char *record;
+
+  memcpy(&r, reference, sizeof(uint64_t));
+
+  if(permutation_output)
+  {
+    output_block((char *) &r, sizeof(uint64_t));
+    return;
+  }
+
+  /* find the file that holds the record, starting from the last one used */
+  while(r < record_base[i]) i--;
+  while(r >= record_base[i] + record_size[i]) i++;
+
+  record = record_data[i] + (r - record_base[i]);
+  output_string(record, find_separator(record, record_data[i]+record_size[i]) - record, NULL, 0);
+}
+
+/* write out the records of a list of keys consumed by a trie node, and
+ * return the memory allocated to the list 
+ */
+static uint64_t output_exhausted_records(uint64_t *list, char *path, uint32_t len)
+{
+  uint64_t i=0, num=*list;
+
+  if(partial_output)
+  {
+    if(!key_in_range(path, len, NULL, 0)) num=0;
+    if(num > head_remaining) num=head_remaining;
+    head_remaining-=num;
+  }
+
+  for(i=0; i<num; i++) output_record((char *) (list + 2 + i));
+  return (2 + *(list+1)) * sizeof(uint64_t) + ALLOC_OVERHEAD;
+}
+
+/* unmap the files of records, once they have been written out */
+void release_records()
+{
+  uint32_t i=0;
+
+  for(i=0; i<num_record_files; i++) unmap_file(record_data[i], record_size[i]);
+  free(record_data);
+  free(record_size);
+  free(record_base);
+}
+
+/* With a sample interval, every nth string of the input is read before any
+ * string is inserted, and the upper levels of the burst trie are built from 
+ * the sample: a trie node is created for each prefix that is expected to be 
+ * shared by enough strings to burst its container. Most strings then land in
+ * containers that will not be burst, rather than being copied once per level
+ * as the trie deepens.
+ */
+uint32_t sample_interval=0;
+uint64_t pre_burst_tries=0;
+
+/* create the trie nodes below a trie node for a sorted range of the sample,
+ * whose strings share a prefix of the given length
+ */
+static void pre_burst_range(char **c_trie, ptr_struct *sample, uint64_t lo, uint64_t hi, uint32_t depth)
+{
+  uint64_t i=0, j=0, bytes=0;
+  uint8_t c=0;
+  char *x;
+
+  /* skip the strings consumed by this trie node, which are sorted first */
+  while(lo < hi && sample[lo].len == depth) lo++;
+
+  for(i=lo; i<hi; i=j)
+  {
+    c = sample[i].key[depth];
+
+    for(j=i, bytes=0; j<hi && sample[j].key[depth] == c; j++) bytes += sample[j].len - depth;
+
+    /* only characters that are traversed can lead to a trie node */
+    if(c < MIN_RANGE) continue;
+
+    /* the container is expected to be burst if it would hold more than twice
+     * the strings (or bytes) allowed. The margin keeps the noise of a small
+     * sample from creating trie nodes that would never have been burst.
+     */
+    if((j-i) * sample_interval <= 2*BUCKET_SIZE_LIM && 
+       bytes * sample_interval <= 2*(uint64_t) BUCKET_BYTE_LIM) continue;
+
+    if( (x = *(c_trie+c)) == NULL)
+    {
+      x = TAG_TRIE(new_trie());
+      *(c_trie+c) = x;
+      pre_burst_tries++;
+    }
+    pre_burst_range(UNTAG_TRIE(x), sample, i, j, depth+1);
+  }
+}
+
+/* sample every nth string of the files to insert, and build the upper levels
+ * of the burst trie from the sample. Return the time taken.
+ */
+double pre_burst(char **files, int num_files)
+{
+  timer start, stop;
+  ptr_struct *sample=NULL;
+  uint64_t num_sampled=0, sample_capacity=0, counter=0;
+  char **buffer = calloc(num_files, sizeof(char *));
+  uint64_t *size = calloc(num_files, sizeof(uint64_t));
+  char *x, *end, *string_end;
+  int i=0;
+
+  if(buffer == NULL || size == NULL) fatal(MEMORY_EXHAUSTED);
+
+  gettimeofday(&start, NULL);
+
+  for(i=0; i<num_files; i++)
+  {
+    buffer[i] = map_file(files[i], size+i);
+    end = buffer[i]+size[i];
+
+    for(x=buffer[i]; x < end; x=string_end+1)
+    {
+      string_end = find_separator(x, end);
+      if(counter++ % sample_interval != 0) continue;
+
+      if(num_sampled == sample_capacity)
+      {
+        sample_capacity = (sample_capacity == 0) ? 65536 : sample_capacity << 1;
+        sample = realloc(sample, sample_capacity * sizeof(ptr_struct));
+        if(sample == NULL) fatal(MEMORY_EXHAUSTED);
+      }
+      sample[num_sampled].key = (uint8_t *) x;
+      sample[num_sampled++].len = string_end-x;
+    }
+  }
+
+  container_sort(sample, num_sampled);
+  pre_burst_range((char **) root_trie, sample, 0, num_sampled, 0);
+
+  for(i=0; i<num_files; i++) unmap_file(buffer[i], size[i]);
+  free(buffer);
+  free(size);
+  free(sample);
+
+  gettimeofday(&stop, NULL);
+  return ( stop.tv_sec - start.tv_sec ) + 0.000001 * ( stop.tv_usec - start.tv_usec );
+}
+
+/* In a parallel build, the strings are partitioned on their two leading bytes.
+ * Each worker thread owns a contiguous range of leading bytes and builds its 
+ * own burst trie from the strings in that range, so the tries can be built 
+ * without any locks. Once built, the tries are traversed in the order of 
+ * their ranges, which yields the same output as the serial build.
+ *
+ * Each file is mapped into memory and processed in phases, separated by a 
+ * barrier: the workers first record where each string in their slice of the 
+ * file starts, along with its length, and count the leading bytes. The counts of 
+ * the first file are used to balance the ranges owned by the workers. Next,
+ * each worker groups the strings in its slice by the worker that owns them,
+ * and finally, each worker inserts the strings that it owns from every slice.
+ */
+#define NUM_PREFIXES 65536
+
+typedef struct parallel_slice
+{
+  uint64_t *offset;          /* the start of each string in the slice */
+  uint32_t *length;          /* the length of each string in the slice */
+  uint64_t num_offsets;
+  uint64_t offset_capacity;
+  uint64_t *grouped_offset;  /* the starts and lengths, grouped by their owner */
+  uint32_t *grouped_length;
+  uint64_t *owner_start;     /* where the strings of each owner begin */
+  uint64_t *prefix_count;    /* the number of strings per leading bytes */
+}
+parallel_slice;
+
+int num_threads=1;
+int streaming=0;
+parallel_slice *slices;
+pthread_t *workers;
+pthread_barrier_t parallel_barrier;
+pthread_mutex_t stats_lock=PTHREAD_MUTEX_INITIALIZER;
+uint32_t parallel_done=0;
+uint32_t ranges_assigned=0;
+uint16_t *prefix_owner;
+char *parallel_buffer;
+uint64_t parallel_buffer_size;
+
+/* return the two leading bytes of a string as a number that preserves their order */
+static inline uint32_t leading_prefix(char *word, uint32_t len)
+{
+  uint8_t *x = (uint8_t *) word;
+
+  if(len == 0) return 0;
+  return ( (uint32_t) *x << 8 ) | ( (len > 1) ? *(x+1) : 0 );
+}
+
+/* assign contiguous ranges of leading bytes to the workers, so that each 
+ * worker owns roughly the same number of strings 
+ */
+void assign_ranges()
+{
+  uint64_t total=0, so_far=0;
+  uint32_t i=0, t=0, owner=0;
+
+  for(i=0; i<NUM_PREFIXES; i++)
+    for(t=0; t<num_threads; t++)
+      total += slices[t].prefix_count[i];
+
+  for(i=0; i<NUM_PREFIXES; i++)
+  {
+    prefix_owner[i]=owner;
+
+    for(t=0; t<num_threads; t++)
+      so_far += slices[t].prefix_count[i];
+
+    if(owner < num_threads-1 && so_far * num_threads >= total * (owner+1))
+      owner++;
+  }
+  ranges_assigned=1;
+}
+
+/* record where each string in the slice starts and its length, and count the 
+ * leading bytes 
+ */
+void scan_slice(parallel_slice *slice, uint64_t lo, uint64_t hi)
+{
+  uint64_t i=lo, end=0;
+  char *buffer_end = parallel_buffer+parallel_buffer_size;
+
+  memset(slice->prefix_count, 0, NUM_PREFIXES*sizeof(uint64_t));
+  slice->num_offsets=0;
+
+  /* a string starts at the beginning of the buffer and after every newline or 
+   * null character. Skip the tail of a string that starts in the previous slice.
+   */
+  if(i != 0)
+  {
+    i = find_separator(parallel_buffer+i-1, buffer_end) - parallel_buffer + 1;
+  }
+
+  /* as in perform_insertion(), an empty file holds a single empty string */
+  if(parallel_buffer_size == 0 && slice == slices) hi=1;
+
+  while(i < hi)
+  {
+    if(slice->num_offsets == slice->offset_capacity)
+    {
+      slice->offset_capacity <<= 1;
+      slice->offset = realloc(slice->offset, slice->offset_capacity * sizeof(uint64_t));
+      slice->length = realloc(slice->length, slice->offset_capacity * sizeof(uint32_t));
+      if(slice->offset == NULL || slice->length == NULL) fatal(MEMORY_EXHAUSTED);
+    }
+
+    end = find_separator(parallel_buffer+i, buffer_end) - parallel_buffer;
+
+    *(slice->offset + slice->num_offsets) = i;
+    *(slice->length + slice->num_offsets++) = end-i;
+    slice->prefix_count[leading_prefix(parallel_buffer+i, end-i)]++;
+
+    i = end+1;
+
+    if(i >= parallel_buffer_size) break;
+  }
+}
+
+/* group the strings of a slice by the worker that owns them */
+void group_slice(parallel_slice *slice)
+{
+  uint64_t i=0;
+  uint32_t owner=0;
+
+  memset(slice->owner_start, 0, (num_threads+1)*sizeof(uint64_t));
+
+  for(i=0; i<NUM_PREFIXES; i++)
+    slice->owner_start[prefix_owner[i]+1] += slice->prefix_count[i];
+
+  for(owner=0; owner<num_threads; owner++)
+    slice->owner_start[owner+1] += slice->owner_start[owner];
+
+  slice->grouped_offset = realloc(slice->grouped_offset, (slice->num_offsets+1) * sizeof(uint64_t));
+  slice->grouped_length = realloc(slice->grouped_length, (slice->num_offsets+1) * sizeof(uint32_t));
+  if(slice->grouped_offset == NULL || slice->grouped_length == NULL) fatal(MEMORY_EXHAUSTED);
+
+  /* use the end of each group as a cursor, to keep the strings in their order */
+  {
+    uint64_t cursor[num_threads];
+    memcpy(cursor, slice->owner_start, num_threads*sizeof(uint64_t));
+
+    for(i=0; i<slice->num_offsets; i++)
+    {
+      owner = prefix_owner[leading_prefix(parallel_buffer + *(slice->offset+i), *(slice->length+i))];
+      *(slice->grouped_offset + cursor[owner]) = *(slice->offset+i);
+      *(slice->grouped_length + cursor[owner]++) = *(slice->length+i);
+    }
+  }
+}
+
+/* In a parallel build, the tries are also traversed in parallel. Each worker
+ * first collects the containers of its trie, and the strings consumed by its
+ * trie nodes, as a list of items in trie order. The main thread cuts the items
+ * of all workers into tasks of roughly TRAVERSAL_TASK_BYTES of strings, and 
+ * deals them out to the workers in contiguous blocks. A worker sorts the 
+ * containers of a task into the task's own output buffer. Once its block is
+ * empty, a worker steals tasks from the back of the other blocks. The main 
+ * thread writes out the buffers in task order, which is trie order.
+ */
+#define TRAVERSAL_TASK_BYTES 262144
+
+typedef struct traversal_item
+{
+  char *container;           /* null for the strings consumed by a trie node */
+  uint64_t num_consumed;     /* the string-exhaust count of the trie node */
+  uint64_t prefix;           /* where the path to the item is in the prefix buffer */
+  uint32_t prefix_len;
+}
+traversal_item;
+
+typedef struct traversal_list
+{
+  traversal_item *item;
+  uint64_t num_items;
+  uint64_t item_capacity;
+  char *prefix;
+  uint64_t prefix_size;
+  uint64_t prefix_capacity;
+  uint64_t bucket_mem;
+  uint64_t num_buckets;
+  uint64_t num_tries;
+  uint64_t max_trie_depth;
+  uint64_t depth_accumulator;
+}
+traversal_list;
+
+typedef struct traversal_task
+{
+  uint32_t worker;           /* the worker whose items are covered by the task */
+  uint64_t first_item;
+  uint64_t last_item;
+  char *output;
+  uint64_t output_size;
+  uint64_t output_capacity;
+  uint32_t done;
+}
+traversal_task;
+
+typedef struct task_deque
+{
+  pthread_mutex_t lock;
+  uint64_t head;
+  uint64_t tail;
+}
+task_deque;
+
+traversal_list *lists;
+traversal_task *tasks;
+uint64_t num_tasks=0;
+task_deque *deques;
+pthread_mutex_t task_lock=PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t task_cond=PTHREAD_COND_INITIALIZER;
+
+/* append an item to a worker's list, along with the path that leads to it */
+void add_item(traversal_list *list, char *container, uint64_t num_consumed, char *path, uint32_t prefix_len)
+{
+  traversal_item *item;
+
+  if(list->num_items == list->item_capacity)
+  {
+    list->item_capacity = (list->item_capacity == 0) ? 1024 : list->item_capacity << 1;
+    list->item = realloc(list->item, list->item_capacity * sizeof(traversal_item));
+    if(list->item == NULL) fatal(MEMORY_EXHAUSTED);
+  }
+
+  while(list->prefix_size + prefix_len > list->prefix_capacity)
+  {
+    list->prefix_capacity = (list->prefix_capacity == 0) ? 65536 : list->prefix_capacity << 1;
+    list->prefix = realloc(list->prefix, list->prefix_capacity);
+    if(list->prefix == NULL) fatal(MEMORY_EXHAUSTED);
+  }
+
+  item = list->item + list->num_items++;
+  item->container = container;
+  item->num_consumed = num_consumed;
+  item->prefix = list->prefix_size;
+  item->prefix_len = prefix_len;
+
+  memcpy(list->prefix + list->prefix_size, path, prefix_len);
+  list->prefix_size += prefix_len;
+}
+
+/* run an in-order traversal of a trie to collect its items, in the same order
+ * as in_order() would print them 
+ */
+void collect_items(traversal_list *list, char **c_trie, int local_depth, char *path)
+{
+  unsigned int i=0;
+  char *x;
+
+  if(local_depth > list->max_trie_depth)  list->max_trie_depth=local_depth;
+  list->num_tries++;
+
+  /* get the number of strings consumed by this trie */
+  uint64_t num_consumed_trie = *(uint64_t *)(c_trie+STRING_EXHAUST_TRIE);
+
+  if(num_consumed_trie != 0)
+  {
+    add_item(list, NULL, num_consumed_trie, path, local_depth-1);
+  }
+
+  /* scan the trie node from left to right */
+  for(i=MIN_RANGE; i<MAX_RANGE; i++)
+  { 
+    if ( (x = *(c_trie + i)) == NULL) 
+    {
+      continue;
+    }
+
+    path[local_depth-1]=(char)i;
+      
+    if( is_it_a_trie(x) ) 
+    {
+      collect_items(list, UNTAG_TRIE(x), local_depth+1, path);
+    }
+    else
+    {
+      add_item(list, x, 0, path, local_depth);
+
+      list->bucket_mem += container_memory(x);
+      list->num_buckets++;
+      list->depth_accumulator+=local_depth;
+    }
+  }
+}
+
+/* append a string, made of a prefix and a suffix, to the output of a task */
+static inline void append_output(traversal_task *task, char *prefix, uint32_t prefix_len, 
+                                 char *suffix, uint32_t suffix_len)
+{
+  uint64_t required = task->output_size + prefix_len + suffix_len + 1;
+
+  if(required > task->output_capacity)
+  {
+    while(required > task->output_capacity)
+    {
+      task->output_capacity = (task->output_capacity == 0) ? 65536 : task->output_capacity << 1;
+    }
+    task->output = realloc(task->output, task->output_capacity);
+    if(task->output == NULL) fatal(MEMORY_EXHAUSTED);
+  }
+
+  memcpy(task->output + task->output_size, prefix, prefix_len);
+  memcpy(task->output + task->output_size + prefix_len, suffix, suffix_len);
+  task->output_size = required;
+  *(task->output + required - 1) = '\n';
+}
+
+/* sort the containers of a task and print their strings into its output buffer */
+void run_task(traversal_task *task)
+{
+  traversal_list *list = lists+task->worker;
+  traversal_item *item;
+  uint64_t i=0, j=0;
+  uint32_t num=0;
+
+  for(i=task->first_item; i<task->last_item; i++)
+  {
+    item = list->item+i;
+    char *prefix = list->prefix + item->prefix;
+
+    if(item->container == NULL)
+    {
+      for(j=0; j<item->num_consumed; ++j)
+      {
+        append_output(task, prefix, item->prefix_len, NULL, 0);
+      }
+      continue;
+    }
+
+    char *x = item->container;
+    uint32_t num_consumed_bucket = *(uint32_t *)(x+STRING_EXHAUST_CONTAINER);
+
+    for(j=0; j<num_consumed_bucket; ++j)
+    {
+      append_output(task, prefix, item->prefix_len, NULL, 0);
+    }
+
+    if(*(x+CONSUMED)==1)
+    {
+      num = sort_container(x);
+
+      for(j=0; j<num; ++j)
+      {
+        append_output(task, prefix, item->prefix_len, (char *) str_ptr[j].key, str_ptr[j].len);
+      }
+    }
+
+    free_traversed_container(x);
+  }
+
+  pthread_mutex_lock(&task_lock);
+  task->done=1;
+  pthread_cond_broadcast(&task_cond);
+  pthread_mutex_unlock(&task_lock);
+}
+
+/* take the next task from the front of a worker's own block of tasks, or 
+ * steal one from the back of another worker's block. Return -1 once there
+ * are no tasks left. 
+ */
+int64_t next_task(uint32_t id)
+{
+  uint32_t k=0;
+  int64_t task=-1;
+
+  for(k=0; k<num_threads && task == -1; k++)
+  {
+    task_deque *deque = deques + ((id+k) % num_threads);
+
+    pthread_mutex_lock(&deque->lock);
+    if(deque->head < deque->tail)
+    {
+      task = (k == 0) ? deque->head++ : --deque->tail;
+    }
+    pthread_mutex_unlock(&deque->lock);
+  }
+  return task;
+}
+
+/* cut the items of every worker into tasks, and deal out the tasks */
+void deal_tasks()
+{
+  uint64_t capacity=1024, weight=0, i=0;
+  uint32_t t=0;
+
+  tasks = calloc(capacity, sizeof(traversal_task));
+  deques = calloc(num_threads, sizeof(task_deque));
+  if(tasks == NULL || deques == NULL) fatal(MEMORY_EXHAUSTED);
+
+  for(t=0; t<num_threads; t++)
+  {
+    traversal_list *list = lists+t;
+
+    for(i=0; i<list->num_items; i++)
+    {
+      traversal_item *item = list->item+i;
+
+      /* start a new task at the start of each list, or once the current task is heavy enough */
+      if(i == 0 || weight >= TRAVERSAL_TASK_BYTES)
+      {
+        if(num_tasks == capacity)
+        {
+          tasks = realloc(tasks, (capacity << 1) * sizeof(traversal_task));
+          if(tasks == NULL) fatal(MEMORY_EXHAUSTED);
+          memset(tasks+capacity, 0, capacity * sizeof(traversal_task));
+          capacity <<= 1;
+        }
+        tasks[num_tasks].worker = t;
+        tasks[num_tasks].first_item = i;
+        num_tasks++;
+        weight=0;
+      }
+      tasks[num_tasks-1].last_item = i+1;
+
+      if(item->container == NULL)
+        weight += item->num_consumed * (item->prefix_len+1);
+      else
+        weight += *(uint32_t *)(item->container+CONTAINER_SIZE) + BUCKET_OVERHEAD;
+    }
+  }
+
+  for(t=0; t<num_threads; t++)
+  {
+    pthread_mutex_init(&deques[t].lock, NULL);
+    deques[t].head = num_tasks * t / num_threads;
+    deques[t].tail = num_tasks * (t+1) / num_threads;
+  }
+}
+
+/* write out the output of each task, in task order, as soon as it is done */
+void write_tasks()
+{
+  uint64_t i=0;
+
+  for(i=0; i<num_tasks; i++)
+  {
+    pthread_mutex_lock(&task_lock);
+    while(!tasks[i].done) pthread_cond_wait(&task_cond, &task_lock);
+    pthread_mutex_unlock(&task_lock);
+
+    output_block(tasks[i].output, tasks[i].output_size);
+    free(tasks[i].output);
+  }
+}
+
+/* the body of a worker thread in a parallel build */
+void *parallel_worker(void *arg)
+{
+  uint32_t id = (uint32_t) (uintptr_t) arg;
+  parallel_slice *slice = slices+id;
+  uint32_t t=0;
+  uint64_t i=0;
+
+  str_ptr = (ptr_struct *)calloc(BUCKET_SIZE_LIM*64, sizeof(ptr_struct *));
+  path = calloc(524288, sizeof(char));
+  if(str_ptr == NULL || path == NULL) fatal(MEMORY_EXHAUSTED);
+
+  init();
+
+  while(1)
+  {
+    /* wait for the next file to be mapped into memory */
+    pthread_barrier_wait(&parallel_barrier);
+    if(parallel_done) break;
+
+    uint64_t lo = parallel_buffer_size * id / num_threads;
+    uint64_t hi = parallel_buffer_size * (id+1) / num_threads;
+
+    scan_slice(slice, lo, hi);
+    pthread_barrier_wait(&parallel_barrier);
+
+    /* the main thread assigns the ranges once the first file has been scanned */
+    pthread_barrier_wait(&parallel_barrier);
+
+    group_slice(slice);
+    pthread_barrier_wait(&parallel_barrier);
+
+    /* insert the strings that this worker owns, from every slice */
+    for(t=0; t<num_threads; t++)
+    {
+      for(i=slices[t].owner_start[id]; i<slices[t].owner_start[id+1]; i++)
+      {
+        insert_with_len(parallel_buffer + *(slices[t].grouped_offset+i), *(slices[t].grouped_length+i));
+      }
+    }
+    pthread_barrier_wait(&parallel_barrier);
+  }
+
+  /* collect the items of this worker's trie, then wait for the tasks to be dealt */
+  collect_items(lists+id, (char **)root_trie, 1, path);
+  pthread_barrier_wait(&parallel_barrier);
+  pthread_barrier_wait(&parallel_barrier);
+
+  int64_t task;
+  while( (task=next_task(id)) != -1)
+  {
+    run_task(tasks+task);
+  }
+
+  /* the containers of this trie may be traversed by other workers, so wait for 
+   * all tasks to complete before the trie is released 
+   */
+  pthread_barrier_wait(&parallel_barrier);
+
+  pthread_mutex_lock(&stats_lock);
+  release_trie();
+  pthread_mutex_unlock(&stats_lock);
+
+  free(str_ptr);
+  free(path);
+  return NULL;
+}
+
+/* start the worker threads of a parallel build */
+void start_parallel_build()
+{
+  uint32_t t=0;
+
+  slices = calloc(num_threads, sizeof(parallel_slice));
+  workers = calloc(num_threads, sizeof(pthread_t));
+  prefix_owner = calloc(NUM_PREFIXES, sizeof(uint16_t));
+  if(slices == NULL || workers == NULL || prefix_owner == NULL) fatal(MEMORY_EXHAUSTED);
+
+  for(t=0; t<num_threads; t++)
+  {
+    slices[t].offset_capacity = 1024;
+    slices[t].offset = malloc(slices[t].offset_capacity * sizeof(uint64_t));
+    slices[t].length = malloc(slices[t].offset_capacity * sizeof(uint32_t));
+    slices[t].owner_start = malloc((num_threads+1) * sizeof(uint64_t));
+    slices[t].prefix_count = malloc(NUM_PREFIXES * sizeof(uint64_t));
+    if(slices[t].offset == NULL || slices[t].length == NULL || slices[t].owner_start == NULL || 
+       slices[t].prefix_count == NULL) 
+      fatal(MEMORY_EXHAUSTED);
+  }
+
+  pthread_barrier_init(&parallel_barrier, NULL, num_threads+1);
+
+  for(t=0; t<num_threads; t++)
+  {
+    if(pthread_create(workers+t, NULL, parallel_worker, (void *) (uintptr_t) t) != 0) 
+      fatal(MEMORY_EXHAUSTED);
+  }
+}
+
+/* map a file into memory and have the worker threads insert its strings. The
+ * phases below must match those of parallel_worker(). 
+ */
+double perform_parallel_insertion(char *to_insert)
+{
+  timer start, stop;
+  double insert_real_time=0.0;
+  uint64_t num_inserted=0;
+  uint32_t t=0;
+
+  parallel_buffer = map_file(to_insert, &parallel_buffer_size);
+
+  /* start the timer for insertion */
+  gettimeofday(&start, NULL);
+
+  /* find the start and length of the strings */
+  pthread_barrier_wait(&parallel_barrier);
+  pthread_barrier_wait(&parallel_barrier);
+
+  if(!ranges_assigned) assign_ranges();
+  pthread_barrier_wait(&parallel_barrier);
+
+  /* group the strings, then insert them */
+  pthread_barrier_wait(&parallel_barrier);
+  pthread_barrier_wait(&parallel_barrier);
+
+  gettimeofday(&stop, NULL);
+
+  insert_real_time = 1000.0 * ( stop.tv_sec - start.tv_sec ) + 0.001  
+  * (stop.tv_usec - start.tv_usec );
+  insert_real_time = insert_real_time/1000.0;
+
+  for(t=0; t<num_threads; t++) num_inserted += slices[t].num_offsets;
+  count_inserted(num_inserted);
+
+  unmap_file(parallel_buffer, parallel_buffer_size);
+  return insert_real_time;
+}
+
+/* have the worker threads traverse, print and free their burst tries */
+void finish_parallel_build()
+{
+  uint32_t t=0;
+
+  lists = calloc(num_threads, sizeof(traversal_list));
+  if(lists == NULL) fatal(MEMORY_EXHAUSTED);
+
+  parallel_done=1;
+  pthread_barrier_wait(&parallel_barrier);
+
+  /* wait for the workers to collect their items */
+  pthread_barrier_wait(&parallel_barrier);
+  deal_tasks();
+  pthread_barrier_wait(&parallel_barrier);
+
+  write_tasks();
+  pthread_barrier_wait(&parallel_barrier);
+
+  for(t=0; t<num_threads; t++)
+  {
+    pthread_join(workers[t], NULL);
+  }
+
+  for(t=0; t<num_threads; t++)
+  {
+    bucket_mem += lists[t].bucket_mem;
+    num_buckets += lists[t].num_buckets;
+    num_tries += lists[t].num_tries;
+    depth_accumulator += lists[t].depth_accumulator;
+    if(lists[t].max_trie_depth > max_trie_depth) max_trie_depth = lists[t].max_trie_depth;
+
+    free(lists[t].item);
+    free(lists[t].prefix);
+    pthread_mutex_destroy(&deques[t].lock);
+    free(slices[t].offset);
+    free(slices[t].length);
+    free(slices[t].grouped_offset);
+    free(slices[t].grouped_length);
+    free(slices[t].owner_start);
+    free(slices[t].prefix_count);
+  }
+  pthread_barrier_destroy(&parallel_barrier);
+
+  free(slices);
+  free(workers);
+  free(prefix_owner);
+  free(lists);
+  free(tasks);
+  free(deques);
+}
+
+/* In a shared build, worker threads insert the strings of each file into the
+ * burst trie of the main thread, rather than into tries of their own. Each 
+ * worker inserts the strings that start within its slice of the file. A new
+ * container is built by its worker alone, and installed into an empty slot 
+ * with a compare-and-swap. A container is only changed under the lock of the
+ * slot that points to it, taken from a table of NUM_CONTAINER_LOCKS locks. A
+ * container is resized or burst under the same lock, and the new container 
+ * or trie node is only assigned to the slot once it is complete. Workers 
+ * allocate from their own slabs and packs, which they keep until the main 
+ * thread has traversed the trie.
+ */
+#define NUM_CONTAINER_LOCKS 4096
+
+uint32_t shared_threads=0;
+uint32_t sharded=0;
+uint32_t shared_done=0;
+char **shard_root;
+char *shared_root;
+uint64_t *shared_inserted;
+pthread_mutex_t container_lock[NUM_CONTAINER_LOCKS];
+
+/* insert a string of a given length into the shared burst trie */
+int concurrent_insert(char *word, uint32_t len)
+{
+  char **c_trie = (char **) shared_root;
+  char **slot;
+  char *x, *expected;
+  pthread_mutex_t *lock;
+  uint32_t r=0;
+
+  while( len != 0 )
+  {
+    slot = c_trie + (unsigned char) *word;
+    x = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+    /* if the slot is empty, build a container to house the string, and try
+     * to install it. If another worker installed a container first, discard
+     * this one and try again.
+     */
+    if(x == NULL)
+    {
+      new_container(private_slot, *word, word+1, len-1);
+      x = *(private_slot + (unsigned char) *word);
+
+      expected = NULL;
+      if(__atomic_compare_exchange_n(slot, &expected, x, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) 
+        return 1;
+
+      free_container(x);
+      continue;
+    }
+
+    if( is_it_a_trie(x) ) 
+    {
+      c_trie = UNTAG_TRIE(x);
+      word++;
+      len--;
+      continue;
+    }
+
+    lock = container_lock + (((uintptr_t) slot >> 3) & (NUM_CONTAINER_LOCKS-1));
+    pthread_mutex_lock(lock);
+
+    /* the container may have been resized or burst while waiting for the lock */
+    if(__atomic_load_n(slot, __ATOMIC_RELAXED) != x)
+    {
+      pthread_mutex_unlock(lock);
+      continue;
+    }
+
+    if(len == 1)
+    {
+      *(uint32_t *)(x+STRING_EXHAUST_CONTAINER) = *(uint32_t *)(x+STRING_EXHAUST_CONTAINER) + 1;
+    }
+    else
+    {
+      r = add_to_bucket_no_search_with_len(x, *word, word+1, c_trie, len-1, (char *) &current_reference);
+      x = *slot;
+
+      if( r > BUCKET_SIZE_LIM || *(uint32_t *)(x+CONTAINER_SIZE) > BUCKET_BYTE_LIM ) 
+        burst_container(x, *word, c_trie);
+    }
+
+    pthread_mutex_unlock(lock);
+    return 1;
+  }
+
+  /* the string was consumed by a trie node */
+  __atomic_fetch_add((uint64_t *)(c_trie+STRING_EXHAUST_TRIE), 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+/* the body of a worker thread in a shared build */
+void *shared_worker(void *arg)
+{
+  uint32_t id = (uint32_t) (uintptr_t) arg;
+  char *buffer_end, *string_end;
+  uint64_t i=0, hi=0;
+
+  init();
+  shard_root[id] = root_trie;
+
+  while(1)
+  {
+    /* wait for the next file to be mapped into memory */
+    pthread_barrier_wait(&parallel_barrier);
+    if(shared_done) break;
+
+    i = parallel_buffer_size * id / shared_threads;
+    hi = parallel_buffer_size * (id+1) / shared_threads;
+    buffer_end = parallel_buffer + parallel_buffer_size;
+
+    /* as with perform_insertion(), an empty file holds an empty string */
+    if(parallel_buffer_size == 0 && id == 0) hi=1;
+
+    /* skip the string that started in the previous slice */
+    if(i != 0) i = find_separator(parallel_buffer+i-1, buffer_end) - parallel_buffer + 1;
+
+    for(; i<hi; i = string_end - parallel_buffer + 1)
+    {
+      string_end = find_separator(parallel_buffer+i, buffer_end);
+      if(sharded)
+        shared_inserted[id] += insert_with_len(parallel_buffer+i, string_end-parallel_buffer-i);
+      else
+        shared_inserted[id] += concurrent_insert(parallel_buffer+i, string_end-parallel_buffer-i);
+    }
+    pthread_barrier_wait(&parallel_barrier);
+  }
+
+  /* the containers of every worker were traversed by the main thread */
+  pthread_mutex_lock(&stats_lock);
+  release_trie();
+  pthread_mutex_unlock(&stats_lock);
+  return NULL;
+}
+
+/* start the worker threads of a shared build, which insert into the burst 
+ * trie of the main thread 
+ */
+void start_shared_build()
+{
+  uint32_t t=0;
+
+  shared_root = root_trie;
+  workers = calloc(shared_threads, sizeof(pthread_t));
+  shared_inserted = calloc(shared_threads, sizeof(uint64_t));
+  shard_root = calloc(shared_threads, sizeof(char *));
+  if(workers == NULL || shared_inserted == NULL || shard_root == NULL) fatal(MEMORY_EXHAUSTED);
+
+  for(t=0; t<NUM_CONTAINER_LOCKS; t++) pthread_mutex_init(container_lock+t, NULL);
+  pthread_barrier_init(&parallel_barrier, NULL, shared_threads+1);
+
+  for(t=0; t<shared_threads; t++)
+  {
+    if(pthread_create(workers+t, NULL, shared_worker, (void *) (uintptr_t) t) != 0) 
+      fatal(MEMORY_EXHAUSTED);
+  }
+}
+
+/* map a file into memory and have the worker threads insert its strings into
+ * the shared burst trie 
+ */
+double perform_shared_insertion(char *to_insert)
+{
+  timer start, stop;
+  double insert_real_time=0.0;
+  uint64_t num_inserted=0;
+  uint32_t t=0;
+
+  parallel_buffer = map_file(to_insert, &parallel_buffer_size);
+  for(t=0; t<shared_threads; t++) shared_inserted[t]=0;
+
+  gettimeofday(&start, NULL);
+
+  pthread_barrier_wait(&parallel_barrier);
+  pthread_barrier_wait(&parallel_barrier);
+
+  gettimeofday(&stop, NULL);
+
+  insert_real_time = 1000.0 * ( stop.tv_sec - start.tv_sec ) + 0.001  
+  * (stop.tv_usec - start.tv_usec );
+  insert_real_time = insert_real_time/1000.0;
+
+  for(t=0; t<shared_threads; t++) num_inserted += shared_inserted[t];
+  count_inserted(num_inserted);
+
+  unmap_file(parallel_buffer, parallel_buffer_size);
+  return insert_real_time;
+}
+
+/* with shards, merge the burst trie of each worker into that of the main 
+ * thread, once every file has been inserted, and return the time taken
+ */
+double merge_shards()
+{
+  timer start, stop;
+  uint32_t t=0;
+
+  gettimeofday(&start, NULL);
+
+  for(t=0; t<shared_threads; t++) merge_trie((char **) root_trie, (char **) shard_root[t]);
+
+  gettimeofday(&stop, NULL);
+  return ( stop.tv_sec - start.tv_sec ) + 0.000001 * ( stop.tv_usec - start.tv_usec );
+}
+
+/* once the main thread has traversed the shared burst trie, have the worker
+ * threads release their slabs and packs 
+ */
+void finish_shared_build()
+{
+  uint32_t t=0;
+
+  shared_done=1;
+  pthread_barrier_wait(&parallel_barrier);
+
+  for(t=0; t<shared_threads; t++)
+  {
+    pthread_join(workers[t], NULL);
+  }
+  pthread_barrier_destroy(&parallel_barrier);
+  for(t=0; t<NUM_CONTAINER_LOCKS; t++) pthread_mutex_destroy(container_lock+t);
+
+  free(workers);
+  free(shared_inserted);
+  free(shard_root);
+}
+
+/* compile with -DNO_MAIN to link the burst trie into another program, such as
+ * burst_trie_check 
+ */
+#ifndef NO_MAIN
+int main(int argc, char **argv)
+{
+   char *to_insert=NULL, *to_search=NULL;
+   char *snapshot_out=NULL, *snapshot_in=NULL;
+   int num_files=0;
+   int i=0;
+   int j=0;
+   double mem=0;
+   double insert_real_time=0.0, search_real_time=0.0;
+   double output_real_time=0.0;
+   uint64_t output_bytes=0;
+   timer start, stop;
+ 
+   /* get the container limit */
+   BUCKET_SIZE_LIM = atoi(argv[1]);
+
+   /* make sure the user supplied a valid bucket size */
+   if (BUCKET_SIZE_LIM < 64 || BUCKET_SIZE_LIM > 512)
+   {
+     puts("Keep bucket size between 128 and 256 strings, inclusive");
+     exit(1);
+   }
+
+   /* since the bursting limit is actually a soft-limit, we need
+    * to make room for some extra ptrs.
+    */
+   str_ptr = (ptr_struct *)calloc(BUCKET_SIZE_LIM*64, sizeof(ptr_struct *));
+   path = calloc(524288, sizeof(char));
+
+   /* get the number of files to insert */ 
+   num_files = atoi(argv[2]);
+
+   /* parse the options that follow the list of files */
+   for(j=3+num_files; j<argc; j++)
+   {
+     if(strcmp(argv[j], "--threads") == 0 && j+1 < argc)
+     {
+       num_threads = atoi(argv[++j]);
+       if(num_threads < 1 || num_threads > NUM_PREFIXES) fatal(BAD_OPTION);
+     }
+     else if(strcmp(argv[j], "--shared") == 0 && j+1 < argc)
+     {
+       shared_threads = atoi(argv[++j]);
+       if(shared_threads < 1) fatal(BAD_OPTION);
+     }
+     else if(strcmp(argv[j], "--shards") == 0 && j+1 < argc)
+     {
+       shared_threads = atoi(argv[++j]);
+       if(shared_threads < 1) fatal(BAD_OPTION);
+       sharded=1;
+     }
+     else if(strcmp(argv[j], "--stream") == 0)
+     {
+       streaming=1;
+     }
+     else if(strcmp(argv[j], "--key-field") == 0 && j+1 < argc)
+     {
+       key_field = atoi(argv[++j]);
+       if(key_field < 1) fatal(BAD_OPTION);
+     }
+     else if(strcmp(argv[j], "--permutation") == 0)
+     {
+       permutation_output=1;
+     }
+     else if(strcmp(argv[j], "--burst-bytes") == 0 && j+1 < argc)
+     {
+       uint64_t limit=0;
+
+       /* leave half of the cache for the array of string pointers and the 
+        * sort itself 
+        */
+       j++;
+       if( (argv[j][0] == 'L' || argv[j][0] == 'l') && argv[j][1] != '\0')
+         limit = cache_size(atoi(argv[j]+1)) / 2;
+       else
+         limit = atol(argv[j]);
+
+       if(limit == 0 || limit >= UINT32_MAX) fatal(BAD_OPTION);
+       BUCKET_BYTE_LIM = limit;
+     }
+     else if(strcmp(argv[j], "--sample") == 0 && j+1 < argc)
+     {
+       sample_interval = atoi(argv[++j]);
+       if(sample_interval < 1) fatal(BAD_OPTION);
+     }
+     else if(strcmp(argv[j], "--unique") == 0)
+     {
+       unique_output=1;
+     }
+     else if(strcmp(argv[j], "--count") == 0)
+     {
+       unique_output=1;
+       count_output=1;
+     }
+     else if(strcmp(argv[j], "--head") == 0 && j+1 < argc)
+     {
+       head_remaining = (uint64_t) atol(argv[++j]);
+       if(head_remaining == 0) fatal(BAD_OPTION);
+       partial_output=1;
+     }
+     else if(strcmp(argv[j], "--range") == 0 && j+2 < argc)
+     {
+       range_lo = argv[++j];
+       range_lo_len = strlen(range_lo);
+       range_hi = argv[++j];
+       range_hi_len = strlen(range_hi);
+       partial_output=1;
+     }
+     else if(strcmp(argv[j], "--search") == 0 && j+1 < argc)
+     {
+       to_search = argv[++j];
+     }
+     else if(strcmp(argv[j], "--save") == 0 && j+1 < argc)
+     {
+       snapshot_out = argv[++j];
+     }
+     else if(strcmp(argv[j], "--load") == 0 && j+1 < argc)
+     {
+       snapshot_in = argv[++j];
+     }
+     else if(strcmp(argv[j], "--pointers") == 0)
+     {
+       pointer_based=1;
+     }
+     else if(strcmp(argv[j], "--memory-budget") == 0 && j+1 < argc)
+     {
+       memory_budget = (uint64_t) atol(argv[++j]) * TO_MB;
+       if(memory_budget == 0) fatal(BAD_OPTION);
+     }
+     else
+     {
+       fatal(BAD_OPTION);
+     }
+   }
+
+   /* streaming and spilling to run files are only supported by the serial build */
+   if(num_threads > 1 && (streaming || memory_budget != 0)) fatal(BAD_OPTION);
+
+   /* record mode keeps every file mapped, and is only supported by the 
+    * serial build, without streaming or spilling 
+    */
+   if(permutation_output && key_field == 0) key_field=1;
+   if(key_field != 0 && pointer_based) fatal(BAD_OPTION);
+
+   /* in unique mode, the serial build collapses duplicates in its containers. 
+    * In count mode, each string in a container carries its count, which must
+    * follow a copy of the string.
+    */
+   if(unique_output && (num_threads > 1 || memory_budget != 0 || key_field != 0)) fatal(BAD_OPTION);
+   if(count_output)
+   {
+     if(pointer_based) fatal(BAD_OPTION);
+     reference_size = sizeof(uint32_t);
+     current_reference = 1;
+   }
+
+   /* a shared build inserts whole strings, without bursting on a budget, and
+    * without compacting containers 
+    */
+   if(shared_threads != 0 && (num_threads > 1 || streaming || memory_budget != 0 || key_field != 0 || 
+      pointer_based || sample_interval != 0 || unique_output)) 
+     fatal(BAD_OPTION);
+
+   /* the burst trie is searched by the thread that built it */
+   if(to_search != NULL && (num_threads > 1 || memory_budget != 0)) fatal(BAD_OPTION);
+
+   /* partial output selects strings as the serial burst trie is traversed */
+   if(partial_output && (num_threads > 1 || memory_budget != 0)) fatal(BAD_OPTION);
+
+   /* a snapshot is saved from the burst trie of the serial build, which must
+    * hold copies of whole strings. Without --count, unique mode keeps a single
+    * copy of each string in the containers it compacts, so the snapshot would
+    * hold too few. A loaded snapshot replaces the build.
+    */
+   if(snapshot_out != NULL && (num_threads > 1 || memory_budget != 0 || key_field != 0 || pointer_based ||
+      (unique_output && !count_output)))
+     fatal(BAD_OPTION);
+   if(snapshot_in != NULL && (num_files != 0 || num_threads > 1 || shared_threads != 0 || streaming || 
+      memory_budget != 0 || key_field != 0 || pointer_based || sample_interval != 0 || snapshot_out != NULL))
+     fatal(BAD_OPTION);
+
+   /* the sample is taken of whole strings, by the serial build */
+   if(sample_interval != 0 && (num_threads > 1 || key_field != 0)) fatal(BAD_OPTION);
+   if(key_field != 0 || pointer_based)
+   {
+     if(num_threads > 1 || streaming || memory_budget != 0) fatal(BAD_OPTION);
+
+     if(key_field != 0) reference_size = sizeof(uint64_t);
+     record_data = calloc(num_files, sizeof(char *));
+     record_size = calloc(num_files, sizeof(uint64_t));
+     record_base = calloc(num_files, sizeof(uint64_t));
+     if(record_data == NULL || record_size == NULL || record_base == NULL) fatal(MEMORY_EXHAUSTED);
+   }
+
+   /* an empty burst trie already holds a pack of trie nodes and a slab of 
+    * containers, so make sure each run has room for as much again 
+    */
+   if(memory_budget != 0)
+   {
+     uint64_t minimum_budget = 2 * ((uint64_t) trie_pack_entry_capacity*TRIE_SIZE + CONTAINER_SLAB_SIZE);
+
+     if(memory_budget < minimum_budget)
+     {
+       printf("Keep the memory budget at or above %lu megabytes\n", (minimum_budget + TO_MB - 1) / TO_MB);
+       exit(1);
+     }
+   }
+
+   /* insert the files in sequence into the standard-chain burst trie and
+    * accumulate the time required
+    */
+   if(num_threads > 1)
+   {
+     start_parallel_build();
+
+     for(i=0, j=3; i<num_files; i++, j++)
+     {
+       to_insert=argv[j];     
+       insert_real_time+=perform_parallel_insertion(to_insert);
+     }
+   }
+   else if(snapshot_in != NULL)
+   {
+     insert_real_time=load_snapshot(snapshot_in);
+   }
+   else
+   {
+     init();
+
+     if(shared_threads != 0) start_shared_build();
+     if(sample_interval != 0) insert_real_time+=pre_burst(argv+3, num_files);
+
+     for(i=0, j=3; i<num_files; i++, j++)
+     {
+       to_insert=argv[j];     
+       if(shared_threads != 0)
+         insert_real_time+=perform_shared_insertion(to_insert);
+       else if(key_field != 0 || pointer_based)
+         insert_real_time+=perform_record_insertion(to_insert);
+       else if(streaming)
+         insert_real_time+=perform_streaming_insertion(to_insert);
+       else
+         insert_real_time+=perform_insertion(to_insert);
+     }
+     if(sharded) insert_real_time+=merge_shards();
+   }
+
+   if(to_search != NULL) search_real_time=perform_search(to_search);
+   if(snapshot_out != NULL) save_snapshot(snapshot_out);
+
+   uint64_t vsize=0;
+   {
+     pid_t mypid;
+     FILE * statf;
+     char fname[1024];
+     uint64_t ret;
+     uint64_t pid; 
+     char commbuf[1024];
+     char state;
+     uint64_t ppid, pgrp, session, ttyd, tpgid;
      uint64_t flags, minflt, cminflt, majflt, cmajflt;
      uint64_t utime, stime, cutime, cstime, counter, priority;
      uint64_t timeout, itrealvalue;
@@ -630,248 +2841,1175 @@ int main(int argc, char **argv)
        &kstkesp, &ksteip, &signal, &blocked, &sigignore, &sigcatch,
        &wchan);
       
-     if (ret != 35) {
-        fprintf(stderr, "Failed to read all 35 fields, only %d decoded\n",
-          ret);
+     if (ret != 35) {
+        fprintf(stderr, "Failed to read all 35 fields, only %d decoded\n",
+          ret);
+     }
+     fclose(statf);
+   }
+
+   /* sort and write out the strings, timing the output stage */
+   output_init(STDOUT_FILENO);
+   gettimeofday(&start, NULL);
+
+   if(num_threads > 1)
+     finish_parallel_build();
+   else if(num_runs > 0)
+     merge_runs();
+   else if(snapshot != NULL)
+     output_snapshot();
+   else
+     destroy();
+
+   if(shared_threads != 0) finish_shared_build();
+
+   if(key_field != 0 || pointer_based) release_records();
+   if(snapshot != NULL) release_snapshot();
+
+   output_bytes = output_finish();
+   gettimeofday(&stop, NULL);
+
+   output_real_time = ( stop.tv_sec - start.tv_sec ) + 0.000001 * ( stop.tv_usec - start.tv_usec );
+   
+   mem=((total_trie_pack_memory/(double)TO_MB) + ((double)bucket_mem/TO_MB));
+   if(num_runs > 0) mem=peak_partition_memory/(double)TO_MB;
+   if(snapshot_in != NULL) mem=snapshot_size/(double)TO_MB;
+   	
+   fprintf(stderr, "%s burst sort %.2f %.2f %.2f %lu %lu %.2f %.2f %u %lu %.2f %lu %.2f %lu --- A version of the burst-sort algorithm "
+                   "implemented by Dr. Nikolas Askitis, Copyright @ 2016, askitisn@gmail.com ", 
+          (pointer_based) ? "Pointer-based" : "Copybased", vsize / (double) TO_MB, 
+          mem, insert_real_time, get_inserted(), BUCKET_SIZE_LIM, output_real_time,
+          (output_real_time > 0) ? output_bytes / (double) TO_MB / output_real_time : 0.0,
+          (BUCKET_BYTE_LIM == UINT32_MAX) ? 0 : BUCKET_BYTE_LIM,
+          num_bursts, burst_bytes / (double) TO_MB, pre_burst_tries, search_real_time, get_found());
+  
+#ifdef PAGING
+   fprintf(stderr, "%s\n", "Paging ");
+#endif
+ 
+#ifdef EXACT_FIT
+   fprintf(stderr, "%s\n", "Exact-fit ");
+#endif
+
+   free(str_ptr);
+   free(sorted_copy);
+   free(path);
+   return 0; 
+}
+#endif
+
+void burst_container(char *bucket, unsigned char path, char **c_trie)
+{
+    char *n_trie;
+
+    thread_bursts++;
+    thread_burst_bytes += *(uint32_t *)(bucket+CONTAINER_SIZE);
+
+    /* allocate a new trie node as a parent */
+    n_trie = new_trie();
+    char **parent = c_trie+path;
+     
+    c_trie = (char **) n_trie;  
+    
+    /* make sure you transfer the string-exhaust flag from the old container to the new trie node */
+    uint64_t tmp=0; /* redundant step to ensure memory is zeroed */
+    tmp =  (uint64_t) *(uint32_t *)(bucket+STRING_EXHAUST_CONTAINER);
+
+    *(uint64_t *)(c_trie+STRING_EXHAUST_TRIE) = tmp;
+    
+    /* reset the string exhaust flag in the container */
+    *(uint32_t *)(bucket+STRING_EXHAUST_CONTAINER)=0;
+
+    /* split the container, passing the reference to the new trie node into the function */
+    split_container(bucket, c_trie);
+
+    /* only assign the new trie node to its parent once it is complete, so that
+     * a concurrent insert never finds a trie node that is half split 
+     */
+    __atomic_store_n(parent, TAG_TRIE(n_trie), __ATOMIC_RELEASE);
+}
+
+void split_container(char *bucket, char **c_trie)
+{
+  char *array = (char *)(bucket+BUCKET_OVERHEAD), *word_start;
+  char *x;
+  uint32_t len;
+  uint32_t num = *(uint32_t *)(bucket+CONTAINER_COUNT);
+
+  /* scan each string in the container; the header records how many there are,
+   * since in record mode a string can be empty 
+   */
+  for(; num != 0; num--)
+  {
+    /* get the length of the current string in the container, and point to
+     * its first letter 
+     */
+    array = read_entry(array, &len);
+    word_start = array;
+
+    /* an empty string was consumed by the container, and now by the new trie */
+    if(len == 0)
+    {
+      add_exhausted_record(c_trie, word_start);
+      array = word_start + reference_size;
+      continue;
+    }
+   
+    /* use the first letter to acquire a pointer in the parent trie */
+    x = *(c_trie + (unsigned char) *array);
+
+    /* if the parent trie node pointer is null, then create a new container */  
+    if (x == NULL)
+    {
+       /* allocate space for the container */
+       x=new_container_block(container_block_size(BUCKET_OVERHEAD));
+
+       /* makes sure the string-exhaust and consumed flags are cleared and
+        * assign the container to the parent trie
+        */
+       *(x+CONSUMED)=0;
+       *(uint32_t *)(x+STRING_EXHAUST_CONTAINER)=0;
+       *(uint32_t *)(x+CONTAINER_SIZE)=0;
+       *(uint32_t *)(x+CONTAINER_COUNT)=0;
+       *(c_trie + (unsigned char) *array)=x;
+    }   
+    
+    /* if after consuming the first character in the current string, you consume
+     * the string, then set the string-exhaust flag in the current container
+     */
+    if( (len-1)==0 && key_field == 0 ) 
+    {
+      uint32_t count=1;
+
+      /* in count mode, the string may stand for several */
+      if(count_output) memcpy(&count, word_start+len, sizeof(uint32_t));
+      *(uint32_t *)(x+STRING_EXHAUST_CONTAINER) = *(uint32_t *)(x+STRING_EXHAUST_CONTAINER) + count;
+    }
+    else
+    {
+      add_to_bucket_no_search_with_len(x, *array, stored_suffix(word_start, len)+1, c_trie, len-1, 
+                                       word_start+stored_length(len)); 
+    }
+    
+    array = word_start + stored_length(len) + reference_size;
+  }
+ 
+  /* you don't need the original bucket anymore */
+  free_container(bucket);
+}
+
+/* burst a container, and then the containers that it is split into, until 
+ * none holds more strings or bytes than the limits allow 
+ */
+static void burst_oversized(char **c_trie, unsigned char path)
+{
+  char *x = *(c_trie+path);
+  unsigned int i=0;
+
+  if( *(uint32_t *)(x+CONTAINER_COUNT) <= BUCKET_SIZE_LIM && *(uint32_t *)(x+CONTAINER_SIZE) <= BUCKET_BYTE_LIM ) 
+    return;
+
+  burst_container(x, path, c_trie);
+  c_trie = UNTAG_TRIE(*(c_trie+path));
+
+  for(i=MIN_RANGE; i<MAX_RANGE; i++)
+  {
+    if( (x = *(c_trie+i)) != NULL && !is_it_a_trie(x) ) burst_oversized(c_trie, i);
+  }
+}
+
+/* append the strings of a container, along with their references, to the 
+ * container in a slot of a trie node, and release it. The merged container is
+ * burst if it holds more strings or bytes than the limits allow.
+ */
+static void append_container(char **c_trie, unsigned char path, char *bucket)
+{
+  char *x = *(c_trie+path);
+  uint32_t size = *(uint32_t *)(x+CONTAINER_SIZE);
+  uint32_t increase = *(uint32_t *)(bucket+CONTAINER_SIZE);
+
+  *(uint32_t *)(x+STRING_EXHAUST_CONTAINER) += *(uint32_t *)(bucket+STRING_EXHAUST_CONTAINER);
+
+  if(*(bucket+CONSUMED) == 1)
+  {
+    /* the strings are length-encoded, so they are copied as they are */
+    resize_container(c_trie+path, size, increase+1);
+    x = *(c_trie+path);
+
+    memcpy(x+BUCKET_OVERHEAD+size, bucket+BUCKET_OVERHEAD, increase);
+    *(x+BUCKET_OVERHEAD+size+increase) = '\0';
+
+    *(x+CONSUMED) = 1;
+    *(x+SORTED) = 0;
+    *(uint32_t *)(x+CONTAINER_SIZE) = size + increase;
+    *(uint32_t *)(x+CONTAINER_COUNT) += *(uint32_t *)(bucket+CONTAINER_COUNT);
+  }
+  free_container(bucket);
+
+  burst_oversized(c_trie, path);
+}
+
+/* merge the burst trie rooted at src into the burst trie rooted at dest, by 
+ * walking the two in parallel. A subtrie or container of src whose slot is 
+ * empty in dest is linked in by its pointer, and the strings of containers 
+ * that meet are concatenated. A container that meets a trie node is first 
+ * burst into a trie node of its own. The trie nodes and containers of src 
+ * stay allocated by the thread that built them, which must not release its
+ * burst trie until dest has been traversed.
+ */
+void merge_trie(char **dest, char **src)
+{
+  unsigned int i=0;
+  uint64_t *list;
+  uint64_t j=0;
+  char *x, *y;
+
+  trie_version++;
+
+  /* merge the strings consumed by the trie nodes */
+  if(key_field != 0)
+  {
+    if( (list = (uint64_t *) *src) != NULL )
+    {
+      if(*dest == NULL)
+        *dest = (char *) list;
+      else
+      {
+        for(j=0; j<*list; j++) add_exhausted_record(dest, (char *) (list + 2 + j));
+        free(list);
+      }
+    }
+  }
+  else
+  {
+    *(uint64_t *)(dest+STRING_EXHAUST_TRIE) += *(uint64_t *)(src+STRING_EXHAUST_TRIE);
+  }
+
+  for(i=MIN_RANGE; i<MAX_RANGE; i++)
+  {
+    if( (y = *(src+i)) == NULL) continue;
+
+    if( (x = *(dest+i)) == NULL)
+    {
+      *(dest+i) = y;
+    }
+    else if( is_it_a_trie(x) && is_it_a_trie(y) )
+    {
+      merge_trie(UNTAG_TRIE(x), UNTAG_TRIE(y));
+    }
+    else if( is_it_a_trie(x) || is_it_a_trie(y) )
+    {
+      /* keep the trie node in dest, and burst the container into a trie node
+       * to merge with it 
+       */
+      if( is_it_a_trie(y) )
+      {
+        *(dest+i) = y;
+        y = x;
+        x = *(dest+i);
+      }
+      burst_container(y, i, private_slot);
+      merge_trie(UNTAG_TRIE(x), UNTAG_TRIE(*(private_slot+i)));
+    }
+    else
+    {
+      append_container(dest, i, y);
+    }
+  }
+}
+
+/* write out a string that was inserted num times: num times, or in unique
+ * mode, only once, preceded by num in count mode (as with uniq -c)
+ */
+static inline void output_key(char *prefix, uint32_t prefix_len, char *suffix, uint32_t suffix_len, 
+                              uint64_t num)
+{
+  char count[32];
+
+  if(partial_output)
+  {
+    if(num == 0 || head_remaining == 0 || !key_in_range(prefix, prefix_len, suffix, suffix_len)) return;
+    if(unique_output) 
+      head_remaining--;
+    else
+    {
+      if(num > head_remaining) num=head_remaining;
+      head_remaining -= num;
+    }
+  }
+
+  if(num == 0) return;
+
+  if(count_output) output_block(count, snprintf(count, sizeof(count), "%7lu ", num));
+
+  if(unique_output) 
+    output_string(prefix, prefix_len, suffix, suffix_len);
+  else if(suffix_len == 0)
+    output_repeat(prefix, prefix_len, num);
+  else for(; num != 0; num--) 
+    output_string(prefix, prefix_len, suffix, suffix_len);
+}
+
+/* in unique mode, write out each distinct string of a sorted container once */
+static void output_unique_strings(char *path, uint32_t local_depth, uint32_t num)
+{
+  uint32_t j=0, k=0;
+  uint64_t count=0;
+
+  for(j=0; j<num && head_remaining != 0; j=k)
+  {
+    for(k=j, count=0; k<num && same_string(j, k); k++) count += string_count(k);
+    output_key(path, local_depth, (char *) str_ptr[j].key, str_ptr[j].len, count);
+  }
+}
+
+/* with partial output, write out the strings of a sorted container that lie
+ * within the range, stopping once the head is reached or the strings sort 
+ * after the upper bound
+ */
+static void output_partial_strings(char *path, uint32_t local_depth, uint32_t num)
+{
+  uint32_t j=0;
+
+  for(j=0; j<num && head_remaining != 0; ++j)
+  {
+    if(range_hi != NULL && compare_with_bound(path, local_depth, (char *) str_ptr[j].key, str_ptr[j].len, 
+                                              range_hi, range_hi_len) > 0) break;
+    if(range_lo != NULL && compare_with_bound(path, local_depth, (char *) str_ptr[j].key, str_ptr[j].len, 
+                                              range_lo, range_lo_len) < 0) continue;
+    if(key_field != 0)
+      output_record((char *) str_ptr[j].key + str_ptr[j].len);
+    else
+      output_string(path, local_depth, (char *) str_ptr[j].key, str_ptr[j].len);
+    head_remaining--;
+  }
+}
+
+/* with partial output, release a subtrie that holds no string to write out,
+ * without sorting its containers, while accumulating the memory it used 
+ */
+static void discard_subtrie(char **c_trie, int local_depth)
+{
+  unsigned int i=0;
+  char *x;
+
+  if(local_depth > max_trie_depth)  max_trie_depth=local_depth;
+  num_tries++;
+
+  if(key_field != 0 && (x = *c_trie) != NULL)
+  {
+    bucket_mem += (2 + *((uint64_t *) x + 1)) * sizeof(uint64_t) + ALLOC_OVERHEAD;
+    free(x);
+  }
+
+  for(i=MIN_RANGE; i<MAX_RANGE; i++)
+  {
+    if ( (x = *(c_trie + i)) == NULL) continue;
+
+    if( is_it_a_trie(x) ) 
+    {
+      discard_subtrie( UNTAG_TRIE(x), local_depth+1);
+    }
+    else
+    {
+      bucket_mem += container_memory(x);
+      num_buckets++;
+      free_container(x);
+      depth_accumulator+=local_depth;
+    }
+  }
+}
+
+/* run an in-order traversal of the burst trie to print out the strings
+ * in byte order, and also to accumulate the amount of memory 
+ * allocated and to free the space allocated
+ */
+void in_order(char **c_trie, int local_depth, char *path)
+{
+  unsigned int i=0,j=0;
+  char *x;
+  
+  if(local_depth > max_trie_depth)  max_trie_depth=local_depth;
+  num_tries++;
+
+  /* get the number of strings consumed by this trie */
+  uint64_t num_consumed_trie = *(uint64_t *)(c_trie+STRING_EXHAUST_TRIE);
+
+  output_key(path, local_depth-1, NULL, 0, num_consumed_trie);
+
+  /* in record mode, the records of the keys consumed by this trie are kept in
+   * a list in slot 0 
+   */
+  if(key_field != 0 && (x = *c_trie) != NULL)
+  {
+    bucket_mem += output_exhausted_records((uint64_t *) x, path, local_depth-1);
+    free(x);
+  }
+  
+  /* scan the trie node from left to right */
+  for(i=MIN_RANGE; i<MAX_RANGE; i++)
+  { 
+    if ( (x = *(c_trie + i)) == NULL) 
+    {
+      continue;
+    }
+
+    path[local_depth-1]=(char)i;
+
+    if( partial_output && subtrie_outside_range(path, local_depth) )
+    {
+      if( is_it_a_trie(x) ) 
+        discard_subtrie( UNTAG_TRIE(x), local_depth+1);
+      else
+      {
+        bucket_mem += container_memory(x);
+        num_buckets++;
+        free_container(x);
+        depth_accumulator+=local_depth;
+      }
+      continue;
+    }
+      
+    if( is_it_a_trie(x) ) 
+    {
+      in_order( UNTAG_TRIE(x), local_depth+1, path);
+    }
+    else
+    {   
+      unsigned int j=0;
+      unsigned int num=0;
+      unsigned int num_consumed_bucket=0;
+
+      num_consumed_bucket=*(uint32_t *)(x+STRING_EXHAUST_CONTAINER);
+
+      output_key(path, local_depth, NULL, 0, num_consumed_bucket);
+ 
+      if(*(x+CONSUMED)==1)
+      {
+         /* sort the strings in the container */
+         num = sort_container(x);
+
+         /* iterate through the set of sorted string pointers to print out the
+          * strings, each written as the path followed by its suffix 
+          */
+         if(unique_output)
+         {
+           output_unique_strings(path, local_depth, num);
+         }
+         else if(partial_output)
+         {
+           output_partial_strings(path, local_depth, num);
+         }
+         else for(j=0; j<num; ++j)
+         {
+           if(key_field != 0)
+             output_record((char *) str_ptr[j].key + str_ptr[j].len);
+           else
+             output_string(path, local_depth, (char *) str_ptr[j].key, str_ptr[j].len);
+         }
+      }
+
+      bucket_mem += container_memory(x);
+      num_buckets++;
+
+      free_container(x);
+      depth_accumulator+=local_depth;
      }
-     fclose(statf);
    }
+}
+
+/* assign each string in a container to a pointer in str_ptr, sort the set of
+ * string pointers, and return the number of strings 
+ */
+uint32_t sort_container(char *bucket)
+{
+  uint32_t num = container_entries(bucket);
+
+  /* a container that has been searched is already in order */
+  if(*(bucket+SORTED) == 1) return num;
+
+#ifdef TUNED_QSORT
+  tuned_qsort(str_ptr, num);
+#elif defined(CACHED_PREFIX_SORT)
+  container_sort_cached(str_ptr, num);
+#else
+  container_sort(str_ptr, num);
+#endif
+  return num;
+}
+
+/* assign each string in a container to a pointer in str_ptr, in the order 
+ * stored, and return the number of strings 
+ */
+uint32_t container_entries(char *bucket)
+{
+  char *x = bucket+BUCKET_OVERHEAD;
+  uint32_t len=0;
+  uint32_t num=0;
+  uint32_t count = *(uint32_t *)(bucket+CONTAINER_COUNT);
+
+  while( num != count )
+  {
+    x=read_entry(x, &len);
+    str_ptr[num].key=stored_suffix(x, len); 
+    str_ptr[num++].len=len;
+    x=x+stored_length(len)+reference_size;
+  }
+  return num;
+}
+
+/* return the memory allocated to a container. Containers that fit within a 
+ * size class are accounted for by their slabs. 
+ */
+uint64_t container_memory(char *bucket)
+{
+  uint32_t bytes = *(uint32_t *)(bucket+CONTAINER_SIZE) + 1 + BUCKET_OVERHEAD;
+
+#ifdef EXACT_FIT
+  return bytes + ALLOC_OVERHEAD; 
+#else
+  uint32_t temp = container_block_size(bytes);
+
+  if(temp > CONTAINER_CLASS_LIMIT)
+  {
+    return temp + ALLOC_OVERHEAD;
+  }
+  return 0;
+#endif
+}
+
+/* free the memory allocated by the burst trie, including the trie nodes */
+void destroy()
+{
+  in_order((char **)root_trie, 1, path); 
+  release_trie();
+}
+
+/* A snapshot saves a burst trie, with its containers sorted, into a file that
+ * can be mapped into memory and searched or written out as it is, without 
+ * being built again. Trie nodes and containers refer to each other by their 
+ * offset in the file, rather than by pointers, so the file can be mapped 
+ * anywhere. The file starts with a snapshot_header, and the children are 
+ * written before their parents, so the root trie node comes last. Nodes and
+ * containers start on 8-byte boundaries.
+ *
+ * A trie node holds the number of strings it consumed, a bitmap of the slots
+ * that are in use, and the offset of the child in each of these slots, in 
+ * slot order. The offset of a child trie node has its lowest bit set. A 
+ * container holds the number of strings it consumed, the number of distinct
+ * strings it stores and the bytes they occupy, followed by the strings in 
+ * sorted order. Each string is length-encoded as in a container of the burst
+ * trie, and is followed by the number of times it was inserted. 
+ */
+#define SNAPSHOT_MAGIC "BURSTSNP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_TRIE 1
+#define SNAPSHOT_NODE_OVERHEAD (5*sizeof(uint64_t))
+#define SNAPSHOT_CONTAINER_OVERHEAD (4*sizeof(uint32_t))
+
+typedef struct snapshot_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t root;             /* the offset of the root trie node */
+  uint64_t num_strings;      /* the number of strings inserted */
+  uint64_t size;             /* the size of the file */
+}
+snapshot_header;
+
+char *snapshot=NULL;
+uint64_t snapshot_size=0;
+uint64_t snapshot_offset=0;
+uint64_t *snapshot_stack=NULL;
+uint64_t snapshot_stack_size=0;
+uint64_t snapshot_stack_capacity=0;
+
+/* append a block of bytes to the snapshot being saved */
+static void snapshot_write(void *data, uint64_t length)
+{
+  output_block(data, length);
+  snapshot_offset += length;
+}
+
+/* pad the snapshot being saved to the next 8-byte boundary */
+static void snapshot_align()
+{
+  uint64_t zero=0;
+
+  if(snapshot_offset & 7) snapshot_write(&zero, 8 - (snapshot_offset & 7));
+}
+
+/* push a value onto the stack of offsets used to save and check a snapshot */
+static void snapshot_push(uint64_t value)
+{
+  if(snapshot_stack_size == snapshot_stack_capacity)
+  {
+    snapshot_stack_capacity = (snapshot_stack_capacity == 0) ? 1024 : snapshot_stack_capacity << 1;
+    snapshot_stack = realloc(snapshot_stack, snapshot_stack_capacity * sizeof(uint64_t));
+    if(snapshot_stack == NULL) fatal(MEMORY_EXHAUSTED);
+  }
+  *(snapshot_stack + snapshot_stack_size++) = value;
+}
+
+/* save a container into the snapshot, with its strings sorted and their copies
+ * counted, and return its offset 
+ */
+static uint64_t save_container(char *bucket)
+{
+  uint32_t header[4] = { *(uint32_t *)(bucket+STRING_EXHAUST_CONTAINER), 0, 0, 0 };
+  uint32_t num=0, j=0, k=0, count=0;
+  uint64_t offset=0;
+  char length[2];
+
+  num = sorted_container(bucket);
+
+  for(j=0; j<num; j=k)
+  {
+    for(k=j+1; k<num && same_string(j, k); k++);
+    header[1]++;
+    header[2] += (( str_ptr[j].len < 128 ) ? 1 : 2) + str_ptr[j].len + sizeof(uint32_t);
+  }
+
+  snapshot_align();
+  offset = snapshot_offset;
+  snapshot_write(header, sizeof(header));
+
+  for(j=0; j<num; j=k)
+  {
+    for(k=j, count=0; k<num && same_string(j, k); k++) count += string_count(k);
+
+    if( str_ptr[j].len < 128 )
+    {
+      length[0] = (char) str_ptr[j].len;
+      snapshot_write(length, 1);
+    }
+    else
+    {
+      length[0] = (char) ( str_ptr[j].len >> 8) | 0x80;
+      length[1] = (char) ( str_ptr[j].len ) & 0xff; 
+      snapshot_write(length, 2);
+    }
+    snapshot_write(str_ptr[j].key, str_ptr[j].len);
+    snapshot_write(&count, sizeof(uint32_t));
+  }
+  return offset;
+}
+
+/* save a subtrie into the snapshot, its children first, and return the offset
+ * of its trie node. The offsets of the children are kept on a stack until 
+ * their parent is written.
+ */
+static uint64_t save_subtrie(char **c_trie)
+{
+  uint64_t node[5] = { trie_exhausted(c_trie), 0, 0, 0, 0 };
+  uint64_t base = snapshot_stack_size, offset=0;
+  unsigned int i=0;
+  char *x;
 
-   destroy();
-   
-   mem=((total_trie_pack_memory/(double)TO_MB) + ((double)bucket_mem/TO_MB));
-   	
-   fprintf(stderr, "Copybased burst sort %.2f %.2f %.2f %d %d --- A version of the burst-sort algorithm "
-                   "implemented by Dr. Nikolas Askitis, Copyright @ 2016, askitisn@gmail.com ", vsize / (double) TO_MB, 
-          mem, insert_real_time, get_inserted(), BUCKET_SIZE_LIM);
-  
-#ifdef PAGING
-   fprintf(stderr, "%s\n", "Paging ");
-#endif
- 
-#ifdef EXACT_FIT
-   fprintf(stderr, "%s\n", "Exact-fit ");
-#endif
+  for(i=MIN_RANGE; i<MAX_RANGE; i++)
+  {
+    if ( (x = *(c_trie + i)) == NULL) continue;
 
-   free(str_ptr);
-   free(path);
-   return 0; 
+    if( is_it_a_trie(x) ) 
+      offset = save_subtrie(UNTAG_TRIE(x)) | SNAPSHOT_TRIE;
+    else
+      offset = save_container(x);
+
+    snapshot_push(offset);
+    node[1 + (i >> 6)] |= (uint64_t) 1 << (i & 63);
+  }
+
+  snapshot_align();
+  offset = snapshot_offset;
+  snapshot_write(node, sizeof(node));
+  snapshot_write(snapshot_stack + base, (snapshot_stack_size - base) * sizeof(uint64_t));
+
+  snapshot_stack_size = base;
+  return offset;
 }
 
-void burst_container(char *bucket, char path, char **c_trie)
+/* save the burst trie of the serial build into a snapshot file. The trie is 
+ * left intact, and its containers stay sorted. 
+ */
+void save_snapshot(char *filename)
 {
-    char *n_trie;
+  snapshot_header header;
+  int32_t file=0;
+
+  if( (file=(int32_t) open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) fatal(BAD_OUTPUT);
+
+  memset(&header, 0, sizeof(header));
+  output_init(file);
+  snapshot_offset = 0;
+  snapshot_write(&header, sizeof(header));
+
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.root = save_subtrie((char **) root_trie);
+  header.num_strings = get_inserted();
+  header.size = snapshot_offset;
+  output_finish();
+
+  /* the header is written last, once the offset of the root is known */
+  if(pwrite(file, &header, sizeof(header), 0) != sizeof(header)) fatal(BAD_OUTPUT);
+  close(file);
+
+  free(snapshot_stack);
+  snapshot_stack=NULL;
+  snapshot_stack_size=snapshot_stack_capacity=0;
+}
 
-    /* allocate a new trie node as a parent */
-    n_trie = new_trie();
-    *(c_trie+path)=n_trie;
-     
-    c_trie = (char **) n_trie;  
-    
-    /* make sure you transfer the string-exhaust flag from the old container to the new trie node */
-    uint64_t tmp=0; /* redundant step to ensure memory is zeroed */
-    tmp =  (uint64_t) *(uint32_t *)(bucket+STRING_EXHAUST_CONTAINER);
+/* the deepest trie node accepted from a snapshot. A string is at most 32767 
+ * characters long, as its length is encoded in 15 bits, so no trie node lies
+ * deeper than that. 
+ */
+#define SNAPSHOT_MAX_DEPTH 32767
 
-    *(uint64_t *)(c_trie+STRING_EXHAUST_TRIE) = tmp;
-    
-    /* reset the string exhaust flag in the container */
-    *(uint32_t *)(bucket+STRING_EXHAUST_CONTAINER)=0;
+uint64_t *snapshot_seen=NULL;
 
-    /* split the container, passing the reference to the new trie node into the function */
-    split_container(bucket, c_trie);
+/* return 1 if a block of a given length at an offset lies within the snapshot,
+ * starts on an 8-byte boundary, and has not been reached before 
+ */
+static int snapshot_block_valid(uint64_t offset, uint64_t length)
+{
+  uint64_t word = offset >> 3;
+
+  if((offset & 7) || offset < sizeof(snapshot_header) || offset > snapshot_size || 
+     length > snapshot_size - offset) 
+    return 0;
+  if((snapshot_seen[word >> 6] >> (word & 63)) & 1) return 0;
+
+  snapshot_seen[word >> 6] |= (uint64_t) 1 << (word & 63);
+  return 1;
 }
 
-void split_container(char *bucket, char **c_trie)
+/* check that a container of the snapshot lies within the file, and that its 
+ * strings end exactly where its header says they do
+ */
+static void check_snapshot_container(uint64_t offset)
 {
-  char *array = (char *)(bucket+BUCKET_OVERHEAD), *word_start;
-  char *x;
-  uint32_t len;
+  char *x, *end;
+  uint32_t len=0, num=0;
+
+  if(!snapshot_block_valid(offset, SNAPSHOT_CONTAINER_OVERHEAD)) fatal(BAD_INPUT);
+
+  x = snapshot + offset;
+  if(*((uint32_t *) x + 2) > snapshot_size - offset - SNAPSHOT_CONTAINER_OVERHEAD) fatal(BAD_INPUT);
+
+  end = x + SNAPSHOT_CONTAINER_OVERHEAD + *((uint32_t *) x + 2);
+  x += SNAPSHOT_CONTAINER_OVERHEAD;
+
+  while(x < end)
+  {
+    if( (unsigned char) *x >= 128 && x+1 >= end ) fatal(BAD_INPUT);
+
+    x = read_entry(x, &len);
+    if(len + sizeof(uint32_t) > (uint64_t) (end - x)) fatal(BAD_INPUT);
+
+    x += len + sizeof(uint32_t);
+    num++;
+  }
+  if(num != *((uint32_t *) (snapshot + offset) + 1)) fatal(BAD_INPUT);
+}
+
+/* check that every trie node and container of the snapshot lies within the
+ * file. Each is reached once, so a damaged file can not lead the traversal 
+ * around in circles. The nodes still to be checked are kept on a stack, with
+ * their depths.
+ */
+static void check_snapshot_nodes(uint64_t root)
+{
+  uint64_t *bitmap, offset=0, depth=0, child=0;
+  uint32_t i=0, num=0;
+
+  snapshot_push(root);
+  snapshot_push(0);
 
-  /* scan the container until you reach the end-of-container (null) flag */
-  while(*array != '\0')
+  while(snapshot_stack_size != 0)
   {
-    /* get the length of the current string in the container */
-    if( (len = (unsigned int) *array ) >= 128)
+    depth = *(snapshot_stack + --snapshot_stack_size);
+    offset = *(snapshot_stack + --snapshot_stack_size);
+
+    if(depth > SNAPSHOT_MAX_DEPTH || !snapshot_block_valid(offset, SNAPSHOT_NODE_OVERHEAD)) 
+      fatal(BAD_INPUT);
+
+    bitmap = (uint64_t *) (snapshot + offset) + 1;
+    for(i=0, num=0; i<4; i++) num += __builtin_popcountll(bitmap[i]);
+
+    if((uint64_t) num * sizeof(uint64_t) > snapshot_size - offset - SNAPSHOT_NODE_OVERHEAD) fatal(BAD_INPUT);
+
+    for(i=0; i<num; i++)
     {
-      len = (unsigned int) ( ( *array & 0x7f ) << 8 ) | (unsigned int)  ( *(++array) & 0xff );
+      child = *((uint64_t *) (snapshot + offset + SNAPSHOT_NODE_OVERHEAD) + i);
+
+      if(child & SNAPSHOT_TRIE)
+      {
+        snapshot_push(child & ~(uint64_t) SNAPSHOT_TRIE);
+        snapshot_push(depth+1);
+      }
+      else
+        check_snapshot_container(child);
     }
-  
-    /* point to the first letter of the current string */
-    array++;
-    word_start = array;
-   
-    /* use the first letter to acquire a pointer in the parent trie */
-    x = *(c_trie + *array);
+  }
 
-    /* if the parent trie node pointer is null, then create a new container */  
-    if (x == NULL)
-    {
-       /* allocate space for the container */
-       x=malloc(BUCKET_OVERHEAD);
-       if(x==NULL) fatal(MEMORY_EXHAUSTED);
+  free(snapshot_stack);
+  snapshot_stack=NULL;
+  snapshot_stack_capacity=0;
+}
 
-       /* makes sure the string-exhaust and consumed flags are cleared and
-        * assign the container to the parent trie
-        */
-       *(x+CONSUMED)=0;
-       *(uint32_t *)(x+STRING_EXHAUST_CONTAINER)=0;
-       *(c_trie + *array)=x;
-    }   
-    
-    /* if after consuming the first character in the current string, you consume
-     * the string, then set the string-exhaust flag in the current container
-     */
-    if( (len-1)==0 ) 
+/* map a snapshot file into memory, check its header and the offsets and 
+ * lengths of its nodes and containers, and return the time taken 
+ */
+double load_snapshot(char *filename)
+{
+  snapshot_header *header;
+  timer start, stop;
+
+  gettimeofday(&start, NULL);
+
+  snapshot = map_file(filename, &snapshot_size);
+  header = (snapshot_header *) snapshot;
+
+  if(snapshot_size < sizeof(snapshot_header) || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+     header->version != SNAPSHOT_VERSION || header->size != snapshot_size) 
+    fatal(BAD_INPUT);
+
+  snapshot_seen = calloc((snapshot_size >> 9) + 1, sizeof(uint64_t));
+  if(snapshot_seen == NULL) fatal(MEMORY_EXHAUSTED);
+
+  check_snapshot_nodes(header->root);
+
+  free(snapshot_seen);
+  snapshot_seen=NULL;
+
+  /* the snapshot is searched at random, and written out in trie order */
+  madvise(snapshot, snapshot_size, MADV_NORMAL);
+  count_inserted(header->num_strings);
+
+  gettimeofday(&stop, NULL);
+  return ( stop.tv_sec - start.tv_sec ) + 0.000001 * ( stop.tv_usec - start.tv_usec );
+}
+
+/* release the mapping of a snapshot file */
+void release_snapshot()
+{
+  unmap_file(snapshot, snapshot_size);
+  snapshot=NULL;
+}
+
+/* return the offset of the child in a slot of a trie node of the snapshot, or
+ * 0 if the slot is empty 
+ */
+static inline uint64_t snapshot_child(char *node, unsigned int i)
+{
+  uint64_t *bitmap = (uint64_t *) node + 1;
+  uint64_t below = bitmap[i >> 6] & (((uint64_t) 1 << (i & 63)) - 1);
+  uint32_t j=0, rank=__builtin_popcountll(below);
+
+  if( ((bitmap[i >> 6] >> (i & 63)) & 1) == 0 ) return 0;
+
+  for(j=0; j < (i >> 6); j++) rank += __builtin_popcountll(bitmap[j]);
+  return *((uint64_t *) (node + SNAPSHOT_NODE_OVERHEAD) + rank);
+}
+
+/* return the number of times a string was inserted, from the snapshot */
+uint64_t snapshot_lookup(char *word, uint32_t len)
+{
+  char *node = snapshot + ((snapshot_header *) snapshot)->root;
+  char *x, *end;
+  uint64_t offset=0;
+  uint32_t entry_len=0, m=0, count=0;
+  int r=0;
+
+  while( len != 0 )
+  {
+    if( (offset = snapshot_child(node, (unsigned char) *word)) == 0 ) return 0;
+
+    word++;
+    len--;
+
+    if(offset & SNAPSHOT_TRIE)
     {
-      *(uint32_t *)(x+STRING_EXHAUST_CONTAINER) = *(uint32_t *)(x+STRING_EXHAUST_CONTAINER) + 1;
+      node = snapshot + (offset & ~(uint64_t) SNAPSHOT_TRIE);
+      continue;
     }
-    else
+
+    /* scan the sorted strings of the container, up to the first that sorts
+     * after the query 
+     */
+    node = snapshot + offset;
+    if(len == 0) return *(uint32_t *) node;
+
+    x = node + SNAPSHOT_CONTAINER_OVERHEAD;
+    end = x + *((uint32_t *) node + 2);
+
+    while(x < end)
     {
-      add_to_bucket_no_search_with_len(x, *array, array+1, c_trie, len-1); 
+      x = read_entry(x, &entry_len);
+      m = (entry_len < len) ? entry_len : len;
+
+      if( (r = memcmp(x, word, m)) == 0 ) r = (entry_len > len) - (entry_len < len);
+      if(r == 0)
+      {
+        memcpy(&count, x + entry_len, sizeof(uint32_t));
+        return count;
+      }
+      if(r > 0) return 0;
+      x += entry_len + sizeof(uint32_t);
     }
-    
-    array = word_start  +  len;
+    return 0;
   }
- 
-  /* you don't need the original bucket anymore */
-  free(bucket);
+  return *(uint64_t *) node;
 }
 
-/* run an in-order traversal of the burst trie to print out the strings
- * in ASCII-7 order, and also to accumulate the amount of memory 
- * allocated and to free the space allocated
+/* a trie node of the snapshot on the path of the traversal, with the next of 
+ * its slots to visit, and the offset of the child in that slot 
  */
-void in_order(char **c_trie, int local_depth, char *path)
+typedef struct snapshot_frame
 {
-  unsigned int i=0,j=0;
-  char *x;
-  
-  if(local_depth > max_trie_depth)  max_trie_depth=local_depth;
+  char *node;
+  uint64_t *child;
+  uint32_t slot;
+}
+snapshot_frame;
+
+/* start on a trie node of the snapshot, where the first depth characters of 
+ * path lead to it, by writing out the strings that end there 
+ */
+static void snapshot_enter(snapshot_frame *frame, char *node, uint32_t depth)
+{
+  if(depth+1 > max_trie_depth) max_trie_depth=depth+1;
   num_tries++;
 
-  /* get the number of strings consumed by this trie */
-  uint64_t num_consumed_trie = *(uint64_t *)(c_trie+STRING_EXHAUST_TRIE);
+  output_key(path, depth, NULL, 0, *(uint64_t *) node);
+
+  frame->node = node;
+  frame->child = (uint64_t *) (node + SNAPSHOT_NODE_OVERHEAD);
+  frame->slot = 0;
+}
 
-  for(j=0; j<num_consumed_trie; ++j)
+/* write out the strings of the snapshot in sorted order. The trie nodes on the
+ * path to the current one are kept on a stack, which the checks made by 
+ * load_snapshot() keep within SNAPSHOT_MAX_DEPTH levels.
+ */
+void output_snapshot()
+{
+  snapshot_frame *stack = malloc((SNAPSHOT_MAX_DEPTH+1) * sizeof(snapshot_frame));
+  snapshot_frame *frame;
+  uint64_t *bitmap;
+  uint32_t depth=0, len=0, count=0;
+  unsigned int i=0;
+  char *x, *end;
+
+  if(stack == NULL) fatal(MEMORY_EXHAUSTED);
+  snapshot_enter(stack, snapshot + ((snapshot_header *) snapshot)->root, 0);
+
+  while(1)
   {
-     printf("%s\n", path);         
-  } 
-  
-  /* scan the trie node from left to right */
-  for(i=MIN_RANGE; i<MAX_RANGE; i++)
-  { 
-    if ( (x = *(c_trie + i)) == NULL) 
+    frame = stack + depth;
+    bitmap = (uint64_t *) frame->node + 1;
+
+    for(i=frame->slot; i<256 && ((bitmap[i >> 6] >> (i & 63)) & 1) == 0; i++);
+
+    /* return to the parent once every slot is visited */
+    if(i == 256 || head_remaining == 0)
     {
+      if(depth == 0) break;
+      depth--;
       continue;
     }
+    frame->slot = i+1;
+    path[depth]=(char)i;
 
-    path[local_depth-1]=(char)i;
-    path[local_depth]='\0';
-      
-    if( is_it_a_trie(x) ) 
+    if( partial_output && subtrie_outside_range(path, depth+1) ) 
     {
-      in_order( (char **)x, local_depth+1, path);
+      frame->child++;
+      continue;
     }
-    else
-    {   
-      char *x_start = x;
-      char *tmp_str;
-      unsigned int j=0;
-      unsigned int k=0;
-      unsigned int len=0;
-      unsigned int num=0;
-      unsigned int num_consumed_bucket=0;
-      char *consumed=0;
 
-      consumed = (char *)(x+CONSUMED);
-      num_consumed_bucket=*(uint32_t *)(x+STRING_EXHAUST_CONTAINER);
-      x=(char *)(x+BUCKET_OVERHEAD);
+    if(*frame->child & SNAPSHOT_TRIE)
+    {
+      x = snapshot + (*frame->child++ & ~(uint64_t) SNAPSHOT_TRIE);
+      depth++;
+      snapshot_enter(stack + depth, x, depth);
+      continue;
+    }
 
-      for(j=0; j<num_consumed_bucket; ++j)
-      { 
-        printf("%s\n", path);         
-      } 
- 
-      if(*consumed==1)
-      {
-         /* assign each string in the bucket to a pointer */
-         while( *x != '\0')
-         {
-            if( ( len = (unsigned int) *x ) >= 128 )
-            {
-               len = (unsigned int) ( ( *x & 0x7f ) << 8 ) | (unsigned int) ( *(++x) & 0xff );
-	    }
-            ++x;      
-            str_ptr[num].key=x; 
-            str_ptr[num++].len=len;
-            x=x+len;
-         }
+    x = snapshot + *frame->child++;
+    output_key(path, depth+1, NULL, 0, *(uint32_t *) x);
 
-         /* sort the set of string pointers */
-         tuned_qsort(str_ptr, num);
+    end = x + SNAPSHOT_CONTAINER_OVERHEAD + *((uint32_t *) x + 2);
+    x += SNAPSHOT_CONTAINER_OVERHEAD;
 
-         /* iterate through the set of sorted string pointers to print out the strings */
-         for(j=0; j<num; ++j)
-         {
-           tmp_str=str_ptr[j].key;
-           len=str_ptr[j].len;
-
-           /* we need to reconstruct the string before we print it, by storing
-            * the path as the prefix. 
-            */
-           for(k=0; k<len; ++k)
-           {
-             *(path+local_depth+k)=*tmp_str;
-             ++tmp_str;
-           }
-           *(path+local_depth+k)='\0';
-           printf("%s\n", path);
-         }
-      }
+    while(x < end && head_remaining != 0)
+    {
+      x = read_entry(x, &len);
+      memcpy(&count, x + len, sizeof(uint32_t));
+      output_key(path, depth+1, x, len, count);
+      x += len + sizeof(uint32_t);
+    }
+    num_buckets++;
+    depth_accumulator+=depth+1;
+  }
+  free(stack);
+}
 
-#ifdef EXACT_FIT
-      bucket_mem += ((x-x_start)+1); 
-#else
-      int temp= ((x-x_start)+1);
+/* sort the burst trie into a new run file and free it. The run file is 
+ * unlinked as soon as it is created, so it disappears once it is closed.
+ */
+void spill_run()
+{
+  char name[4096];
+  char *dir = getenv("TMPDIR");
+  uint64_t partition_memory=0;
+  int32_t file=-1;
 
-      if(temp<=_32_BYTES)
-      {
-        temp=_32_BYTES;
-      }
-      else 
-      {
-        if(temp <= _64_BYTES) 
-        {
-          temp = _64_BYTES;
-        }
-        else 
-        {
-          /* round up to the nearest 64-byte block */
-          temp +=  _64_BYTES-(temp & (_64_BYTES -1 )); 
-        }
+  snprintf(name, sizeof(name), "%s/burstsort-run-XXXXXX", (dir != NULL) ? dir : "/tmp");
+  if( (file = mkstemp(name)) < 0) fatal(BAD_OUTPUT);
+  unlink(name);
 
-        bucket_mem += temp; 
-      }
-#endif
-      bucket_mem += ALLOC_OVERHEAD;
-      num_buckets++;
+  if(num_runs == run_capacity)
+  {
+    run_capacity = (run_capacity == 0) ? 64 : run_capacity << 1;
+    run_file = realloc(run_file, run_capacity * sizeof(int32_t));
+    if(run_file == NULL) fatal(MEMORY_EXHAUSTED);
+  }
+  run_file[num_runs++] = file;
 
-      free(x_start);
-      depth_accumulator+=local_depth;
-     }
-   }
+  output_init(file);
+  destroy();
+  output_finish();
+
+  /* report the memory of the largest partition, rather than of all of them */
+  partition_memory = total_trie_pack_memory + bucket_mem;
+  if(partition_memory > peak_partition_memory) peak_partition_memory = partition_memory;
+  total_trie_pack_memory = 0;
+  bucket_mem = 0;
+
+  large_container_memory = 0;
+  over_budget = 0;
 }
 
-/* free the memory allocated by the burst trie, including the trie nodes */
-void destroy()
+/* a run file being merged, and the string at its head */
+typedef struct run_cursor
+{
+  char *data;
+  char *pos;
+  char *end;
+  uint64_t size;
+  uint32_t len;
+}
+run_cursor;
+
+/* return a negative value if the string at the head of run a sorts before the
+ * string at the head of run b 
+ */
+static inline int32_t compare_runs(run_cursor *a, run_cursor *b)
+{
+  uint32_t len = (a->len < b->len) ? a->len : b->len;
+  int32_t r = memcmp(a->pos, b->pos, len);
+
+  if(r != 0) return r;
+  return (int32_t) a->len - (int32_t) b->len;
+}
+
+/* find the string at the head of a run, and return 0 once the run is empty */
+static inline int next_run_string(run_cursor *run)
+{
+  if(run->pos >= run->end) return 0;
+  run->len = (char *) memchr(run->pos, '\n', run->end - run->pos) - run->pos;
+  return 1;
+}
+
+/* restore the heap order of a heap of runs, from a given position down */
+static void sift_runs(run_cursor **heap, uint32_t num, uint32_t i)
+{
+  run_cursor *run = heap[i];
+  uint32_t child=0;
+
+  while( (child = 2*i+1) < num)
+  {
+    if(child+1 < num && compare_runs(heap[child+1], heap[child]) < 0) child++;
+    if(compare_runs(run, heap[child]) <= 0) break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = run;
+}
+
+/* spill the remaining burst trie, then merge every run file into the output
+ * with a heap of runs, ordered by the string at the head of each run
+ */
+void merge_runs()
+{
+  run_cursor *runs, **heap;
+  struct stat info;
+  uint32_t i=0, num=0;
+
+  spill_run();
+  output_init(STDOUT_FILENO);
+
+  runs = calloc(num_runs, sizeof(run_cursor));
+  heap = calloc(num_runs, sizeof(run_cursor *));
+  if(runs == NULL || heap == NULL) fatal(MEMORY_EXHAUSTED);
+
+  for(i=0; i<num_runs; i++)
+  {
+    if(fstat(run_file[i], &info) != 0) fatal(BAD_INPUT);
+    runs[i].size = info.st_size;
+    if(runs[i].size == 0) continue;
+
+    runs[i].data = mmap(NULL, runs[i].size, PROT_READ, MAP_PRIVATE, run_file[i], 0);
+    if(runs[i].data == MAP_FAILED) fatal(BAD_INPUT);
+    madvise(runs[i].data, runs[i].size, MADV_SEQUENTIAL);
+
+    runs[i].pos = runs[i].data;
+    runs[i].end = runs[i].data + runs[i].size;
+    if(next_run_string(runs+i)) heap[num++] = runs+i;
+  }
+
+  for(i=num/2; i-- > 0; ) sift_runs(heap, num, i);
+
+  while(num > 0)
+  {
+    run_cursor *run = heap[0];
+
+    output_string(run->pos, run->len, NULL, 0);
+    run->pos += run->len + 1;
+
+    if(!next_run_string(run)) heap[0] = heap[--num];
+    if(num > 0) sift_runs(heap, num, 0);
+  }
+
+  for(i=0; i<num_runs; i++)
+  {
+    if(runs[i].size != 0) munmap(runs[i].data, runs[i].size);
+    close(run_file[i]);
+  }
+  free(runs);
+  free(heap);
+  free(run_file);
+}
+
+/* free the trie nodes and the slabs of containers, once every container has 
+ * been traversed 
+ */
+void release_trie()
 {
   int i=0;
-  in_order((char **)root_trie, 1, path); 
   
   for(i=0; i<=trie_pack_idx; i++)  
   {
-    total_trie_pack_memory += (((trie_pack_entry_capacity*TRIE_SIZE) + sizeof(char))+ALLOC_OVERHEAD);
-    free ( *(trie_pack + i ) );
+    total_trie_pack_memory += ((((uint64_t) trie_pack_entry_capacity*TRIE_SIZE) + sizeof(char))+ALLOC_OVERHEAD);
+    free_trie_pack( *(trie_pack + i ) );
   }
   free(trie_pack);
+
+  bucket_mem += free_container_slabs();
+
+  num_bursts += thread_bursts;
+  burst_bytes += thread_burst_bytes;
+  thread_bursts = 0;
+  thread_burst_bytes = 0;
 }
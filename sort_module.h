@@ -17,3 +17,9 @@ ptr_struct;
 
 /* in-place iterative qsort, tuned to reduced instruction usage while maximizing cache usage */
 void tuned_qsort(ptr_struct *data, const uint64_t N);
+
+/* multikey quicksort with an MSD radix sort for large sets, see container_sort.c */
+void container_sort(ptr_struct *data, const uint64_t n);
+
+/* as container_sort(), but compares cached eight-byte prefixes of the strings */
+void container_sort_cached(ptr_struct *data, const uint64_t n);